@@ -22,10 +22,32 @@
 
 #define PROP_MSG_MAX (3 + PROP_NAME_MAX + PROP_VALUE_MAX) /* +3 = +1(opcode) +2(len) */
 
+/* Atomic operations evaluated by the server, see property_atomic_binary() */
+
+#define PROPERTY_ATOMIC_GET 'g' /* read the value and its serial */
+#define PROPERTY_ATOMIC_CAS 'c' /* set if the value equals arg */
+#define PROPERTY_ATOMIC_CAS_SERIAL 's' /* set if the serial equals arg */
+#define PROPERTY_ATOMIC_ADD 'a' /* add the int64_t arg, store as decimal */
+#define PROPERTY_ATOMIC_SET_IF_ABSENT 'n' /* set only if the key is absent */
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+struct property_txn;
+struct property_async;
+
+/**
+ * @brief Completion of an asynchronous request.
+ * @param[in] result the length of the value for get, 0 for set/delete/commit,
+ *   -errno on failure. For monitors the length of the new value.
+ * @param[in] key the changed key for monitors, NULL otherwise
+ * @param[in] value the value for get and monitors, NULL if there is none
+ * @param[in] val_len the length of value
+ * @param[in] cookie the cookie passed at submission
+ */
+typedef void (*property_async_cb)(int result, const char* key, const void* value, size_t val_len, void* cookie);
+
 /**
  * @brief Store Key-Values to database.
  * @param[in] key entry key string
@@ -87,6 +109,17 @@ int property_monitor_open(const char* key);
  */
 ssize_t property_monitor_read(int fd, char* newkey, void* newvalue, size_t val_len);
 
+/**
+ * @brief Read all the pending changes of a monitor channel, waits for the
+ *   first one only
+ * @param[in] fd file descriptor returned by property_monitor_open()
+ * @param[in] propfn callback for every change, value is NULL on delete
+ * @param[in] cookie data to pass to callback function
+ * @return On success returns the number of changes read, -errno otherwise.
+ */
+int property_monitor_read_batch(int fd, void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie),
+    void* cookie);
+
 /**
  * @brief Close a key monitor channel
  * @param[in] fd file descriptor returned by property_monitor_open()
@@ -150,6 +183,33 @@ ssize_t property_get_buffer(const char* key, void* value, size_t size);
 int property_set_binary(const char* key, const void* value, size_t val_len, bool oneway);
 ssize_t property_get_binary(const char* key, void* value, size_t val_len);
 
+/**
+ * @brief Like property_set_binary() and property_get_binary(), giving up
+ *   once the time is over. The deadline travels with the request, the
+ *   server does not serve it after its caller stopped waiting. Keys under
+ *   CONFIG_KVDB_ENV_PREFIX act on the environment as with property_get().
+ * @param[in] key entry key string
+ * @param[in] value buffer value
+ * @param[in] val_len buffer size
+ * @param[in] timeout the most ms to wait, connecting included, <0 forever
+ * @return On success as without a timeout, -ETIMEDOUT once the time is
+ *   over, -errno otherwise.
+ */
+int property_set_binary_timeout(const char* key, const void* value, size_t val_len, int timeout);
+ssize_t property_get_binary_timeout(const char* key, void* value, size_t val_len, int timeout);
+
+/**
+ * @brief Saves a volatile key which the server deletes after ttl, see
+ *   CONFIG_KVDB_TTL. The monitors see the delete, a later set or delete of
+ *   the key cancels the expiry.
+ * @param[in] key entry key string, "persist." keys are refused
+ * @param[in] value buffer value
+ * @param[in] val_len buffer size
+ * @param[in] ttl time to live (in milliseconds)
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_set_ttl(const char* key, const void* value, size_t val_len, uint32_t ttl);
+
 /**
  * @List all KVs in every database and calls callback function.
  * @param[in] callback function
@@ -157,6 +217,248 @@ ssize_t property_get_binary(const char* key, void* value, size_t val_len);
  * @Returns 0 on success, <0 if all databases failed to open.
  */
 int property_list_binary(void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie);
+
+/**
+ * @brief Read the statistics of the server, see CONFIG_KVDB_STATS.
+ * @param[in] propfn callback function, called once per counter with its
+ *   name and its value as a string
+ * @param[in] cookie data to pass to callback function
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_stats(void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie);
+
+/**
+ * @brief Read the requests sampled by the server, see CONFIG_KVDB_TRACE.
+ * @param[in] raw nonzero for every sample as "<ms> <peer> <op> <us> <key>",
+ *   zero for the samples merged per peer, op and key as
+ *   "<count> <peer> <op> <average us> <key>", the busiest first
+ * @param[in] propfn callback function
+ * @param[in] cookie data to pass to callback function
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_trace(int raw, void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie);
+
+/**
+ * @brief Perform a read-modify-write on the server in one round-trip.
+ * @param[in] type one of PROPERTY_ATOMIC_*
+ * @param[in] key entry key string
+ * @param[in] arg the expected value (CAS), the expected serial as uint32_t
+ *                (CAS_SERIAL) or the int64_t delta (ADD)
+ * @param[in] arg_len the length of arg
+ * @param[in] value the value to store (CAS, CAS_SERIAL, SET_IF_ABSENT)
+ * @param[in] val_len the length of value
+ * @param[out] out buffer to receive the current value after the operation,
+ *                 or the conflicting value on -EAGAIN/-EEXIST, may be NULL
+ * @param[in] out_len the size of out
+ * @param[out] serial receive the serial of the key, may be NULL
+ * @note The serial is bumped by the server on every change of the key.
+ *   The keys untouched since the server started or deleted share the
+ *   serial of the last key deleted, which may move on without a change of
+ *   the key, a CAS then fails with -EAGAIN and has to read it again.
+ * @return On success returns the length of the value copied to out,
+ *   -EAGAIN if the comparison failed, -EEXIST if the key already exists
+ *   (SET_IF_ABSENT), -errno otherwise.
+ */
+ssize_t property_atomic_binary(int type, const char* key, const void* arg, size_t arg_len,
+    const void* value, size_t val_len, void* out, size_t out_len, uint32_t* serial);
+
+/**
+ * @brief Retrieve a Key-Value together with its serial.
+ * @param[in] key entry key string
+ * @param[out] value buffer to receive the value, may be NULL
+ * @param[in] val_len the size of value
+ * @param[out] serial receive the serial of the key
+ * @return On success returns the length of the value, -errno otherwise.
+ */
+ssize_t property_get_serial(const char* key, void* value, size_t val_len, uint32_t* serial);
+
+/**
+ * @brief Store value only if the current value equals expected.
+ * @param[in] key entry key string
+ * @param[in] expected the expected value string
+ * @param[in] value entry value string
+ * @return On success returns 0, -EAGAIN on mismatch, -errno otherwise.
+ */
+int property_compare_and_set(const char* key, const char* expected, const char* value);
+
+/**
+ * @brief Store value only if the key was not changed since serial was read.
+ * @param[in] key entry key string
+ * @param[in] serial the serial returned by property_get_serial()
+ * @param[in] value entry value string
+ * @return On success returns 0, -EAGAIN on mismatch, -errno otherwise.
+ */
+int property_compare_and_set_serial(const char* key, uint32_t serial, const char* value);
+
+/**
+ * @brief Store value only if the key does not exist yet.
+ * @param[in] key entry key string
+ * @param[in] value entry value string
+ * @return On success returns 0, -EEXIST if the key exists, -errno otherwise.
+ */
+int property_set_if_absent(const char* key, const char* value);
+
+/**
+ * @brief Add delta to a 64-bit integer property and return the new value.
+ * @param[in] key entry key string, a missing key counts as 0
+ * @param[in] delta the value to add
+ * @param[out] result receive the new value, may be NULL
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_add_and_fetch_int64(const char* key, int64_t delta, int64_t* result);
+
+/**
+ * @brief Start a transaction, sets and deletes are buffered in the caller
+ *   until property_txn_commit().
+ * @return On success returns the transaction handle, NULL otherwise.
+ */
+struct property_txn* property_txn_begin(void);
+
+/**
+ * @brief Add a set operation to the transaction.
+ * @param[in] txn handle returned by property_txn_begin()
+ * @param[in] key entry key string
+ * @param[in] value entry value string
+ * @return On success returns 0, -E2BIG if the transaction is full,
+ *   -errno otherwise.
+ */
+int property_txn_set(struct property_txn* txn, const char* key, const char* value);
+int property_txn_set_binary(struct property_txn* txn, const char* key, const void* value, size_t val_len);
+
+/**
+ * @brief Add a delete operation to the transaction.
+ * @param[in] txn handle returned by property_txn_begin()
+ * @param[in] key entry key string
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_txn_delete(struct property_txn* txn, const char* key);
+
+/**
+ * @brief Apply all operations of the transaction at once and release it.
+ * @param[in] txn handle returned by property_txn_begin()
+ * @note Either all operations take effect or none, unless kvdbd dies while
+ *   applying them. The result is committed before return and monitors are
+ *   notified only after that.
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_txn_commit(struct property_txn* txn);
+
+/**
+ * @brief Drop all operations of the transaction and release it.
+ * @param[in] txn handle returned by property_txn_begin()
+ */
+void property_txn_abort(struct property_txn* txn);
+
+/**
+ * @brief Write a binary image of all the stores, taken at one point in time.
+ * @param[in] fd file or socket to write the image to
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_snapshot(int fd);
+
+/**
+ * @brief Load an image written by property_snapshot() as one transaction,
+ *   monitors are notified once it is applied.
+ * @param[in] fd file or socket to read the image from
+ * @note Keys missing from the image are kept, "ro." keys are skipped. The
+ *   image is limited to CONFIG_KVDB_RESTORE_SIZE bytes of records.
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_restore(int fd);
+
+/**
+ * @brief Open a session for non-blocking requests. Many requests may be
+ *   outstanding at once, they complete in order of submission.
+ * @return On success returns the session handle, NULL and errno otherwise.
+ */
+struct property_async* property_async_open(void);
+
+/**
+ * @brief Get the fd to register in poll/epoll, call property_async_dispatch()
+ *   whenever it is readable.
+ * @param[in] async handle returned by property_async_open()
+ * @return On success returns the fd, -errno otherwise.
+ */
+int property_async_fd(struct property_async* async);
+
+/**
+ * @brief Give the requests submitted next a deadline, the server drops the
+ *   ones it could not serve in time and their cb gets -ETIMEDOUT from
+ *   property_async_dispatch(), possibly before earlier requests complete.
+ *   Subscriptions take no deadline.
+ * @param[in] async handle returned by property_async_open()
+ * @param[in] timeout ms each request may take, <0 for no deadline
+ * @return On success returns 0, -errno otherwise.
+ */
+int property_async_deadline(struct property_async* async, int timeout);
+
+/**
+ * @brief Get the ms until the next deadline, to poll the fd with and call
+ *   property_async_dispatch() when it expires.
+ * @param[in] async handle returned by property_async_open()
+ * @return The ms left, 0 if a deadline is over, -1 if there is none.
+ */
+int property_async_timeout(struct property_async* async);
+
+/**
+ * @brief Submit a request, these never wait for the server.
+ * @param[in] async handle returned by property_async_open()
+ * @param[in] key entry key string, fnmatch pattern for monitor
+ * @param[in] cb called from property_async_dispatch() on completion,
+ *   for monitor on every change until property_async_unmonitor() or
+ *   property_async_close()
+ * @param[in] cookie data to pass to cb
+ * @return On success returns the request id (>0), -EAGAIN if the socket is
+ *   full and property_async_dispatch() should run first, -errno otherwise.
+ */
+int property_async_get(struct property_async* async, const char* key, property_async_cb cb, void* cookie);
+int property_async_set(struct property_async* async, const char* key, const void* value, size_t val_len,
+    property_async_cb cb, void* cookie);
+int property_async_delete(struct property_async* async, const char* key, property_async_cb cb, void* cookie);
+int property_async_commit(struct property_async* async, property_async_cb cb, void* cookie);
+int property_async_monitor(struct property_async* async, const char* key, property_async_cb cb, void* cookie);
+
+/**
+ * @brief Subscribe like property_async_monitor(), with the time of every
+ *   change on the server for latency measurements.
+ * @param[in] async handle returned by property_async_open()
+ * @param[in] key fnmatch pattern of the keys to watch
+ * @param[in] cb called once with a NULL key and the current time on the
+ *   server when the subscription is in place, then on every change with
+ *   the time the server made it. Times are in us modulo 2^31 of the
+ *   server CLOCK_MONOTONIC.
+ * @param[in] cookie data to pass to cb
+ * @return On success returns the subscription id (>0), -errno otherwise.
+ */
+int property_async_watch(struct property_async* async, const char* key, property_async_cb cb, void* cookie);
+
+/**
+ * @brief Drop one subscription of the session, the others stay. Many keys
+ *   or patterns can thus be watched, added and removed over a single fd.
+ * @param[in] async handle returned by property_async_open()
+ * @param[in] id subscription id returned by property_async_monitor()
+ * @param[in] cb called with 0 or -errno once the server dropped it, the
+ *   monitor callback is never called again after this returns
+ * @param[in] cookie data to pass to cb
+ * @return On success returns the request id (>0), -errno otherwise.
+ */
+int property_async_unmonitor(struct property_async* async, int id, property_async_cb cb, void* cookie);
+
+/**
+ * @brief Run the callbacks of everything received so far, never blocks.
+ * @param[in] async handle returned by property_async_open()
+ * @note Callbacks may submit new requests but must not close the session.
+ * @return On success returns the number of callbacks run, -ENOTCONN when
+ *   the server closed the session, -errno otherwise.
+ */
+int property_async_dispatch(struct property_async* async);
+
+/**
+ * @brief Close the session, pending callbacks are dropped.
+ * @param[in] async handle returned by property_async_open()
+ */
+void property_async_close(struct property_async* async);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/param.h>
+#include <sys/socket.h>
+
+#include <kvdb.h>
+
+#include "internal.h"
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* An operation waiting for its reply, monitors stay until close */
+
+struct property_async_op {
+    struct property_async_op* next;
+    uint32_t id;
+    bool monitor;
+    uint8_t flags;
+    int64_t deadline; /* ms, 0 for none */
+    property_async_cb cb;
+    void* cookie;
+};
+
+struct property_async {
+    int fd;
+    uint32_t id;
+    int timeout; /* of the requests submitted next, <0 for none */
+    struct property_async_op* ops;
+    size_t len;
+    char rx[KVDB_FRAME_MAX];
+};
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static int property_async_submit(struct property_async* async, char op,
+    const char* key, const void* value, size_t val_len, bool monitor,
+    uint8_t flags, property_async_cb cb, void* cookie)
+{
+    char frame[sizeof(struct kvdb_frame) + PROP_NAME_MAX + PROP_VALUE_MAX + 4];
+    size_t key_len = 0;
+
+    if (!async)
+        return -EINVAL;
+
+    if (key) {
+        key_len = strlen(key) + 1;
+        if (key_len > PROP_NAME_MAX)
+            return -E2BIG;
+    }
+
+    if (val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    struct property_async_op* pending = malloc(sizeof(struct property_async_op));
+    if (pending == NULL)
+        return -ENOMEM;
+
+    if (++async->id == 0)
+        async->id++;
+
+    /* A subscription lasts, only the other requests take the deadline */
+
+    if (!monitor && async->timeout >= 0)
+        flags |= KVDB_FLAG_DEADLINE;
+
+    struct kvdb_frame req = {
+        .op = op,
+        .key_len = key_len,
+        .val_len = val_len,
+        .flags = flags,
+        .id = async->id,
+    };
+
+    memcpy(frame, &req, sizeof(req));
+    if (key_len)
+        memcpy(frame + sizeof(req), key, key_len);
+    if (val_len)
+        memcpy(frame + sizeof(req) + key_len, value, val_len);
+    if (flags & KVDB_FLAG_DEADLINE) {
+        pending->deadline = kvdb_uptime_ms() + async->timeout;
+
+        uint32_t deadline = kvdb_deadline(pending->deadline);
+        memcpy(frame + sizeof(req) + key_len + val_len, &deadline, sizeof(deadline));
+    } else {
+        pending->deadline = 0;
+    }
+
+    size_t total = KVDB_FRAME_LEN(&req);
+    ssize_t ret = send(async->fd, frame, total, MSG_DONTWAIT);
+    if (ret < 0) {
+        ret = -errno;
+        free(pending);
+        return ret;
+    }
+
+    /* A half sent frame would corrupt the stream, finish it */
+
+    for (size_t sent = ret; sent < total; sent += ret) {
+        ret = send(async->fd, frame + sent, total - sent, 0);
+        if (ret < 0) {
+            ret = -errno;
+            KVERR("send failed, ret=%zd\n", ret);
+            free(pending);
+            return ret;
+        }
+    }
+
+    pending->id = req.id;
+    pending->monitor = monitor;
+    pending->flags = flags;
+    pending->cb = cb;
+    pending->cookie = cookie;
+    pending->next = async->ops;
+    async->ops = pending;
+    return req.id;
+}
+
+/* Handle one frame from the server, return true if a callback ran */
+static bool property_async_complete(struct property_async* async,
+    const struct kvdb_reply* reply, const char* data)
+{
+    struct property_async_op** prev = &async->ops;
+    struct property_async_op* pending;
+
+    while ((pending = *prev) != NULL && pending->id != reply->hdr.id)
+        prev = &pending->next;
+
+    if (pending == NULL)
+        return false;
+
+    const char* key = reply->hdr.key_len ? data : NULL;
+    const void* value = reply->hdr.val_len ? data + reply->hdr.key_len : NULL;
+
+    /* A watch gets the time of the change or of the subscription */
+
+    bool stamp = (pending->flags & KVDB_FLAG_STAMP) != 0;
+
+    if (reply->hdr.op == 'N') {
+        if (pending->cb)
+            pending->cb(stamp ? reply->err : reply->hdr.val_len, key, value,
+                reply->hdr.val_len, pending->cookie);
+        return pending->cb != NULL;
+    }
+
+    /* A monitor is kept once the server accepts the subscription */
+
+    if (pending->monitor && reply->err >= 0) {
+        if (!stamp || pending->cb == NULL)
+            return false;
+
+        pending->cb(reply->err, NULL, NULL, 0, pending->cookie);
+        return true;
+    }
+
+    property_async_cb cb = pending->cb;
+    void* cookie = pending->cookie;
+
+    *prev = pending->next;
+    free(pending);
+    if (cb)
+        cb(reply->err, key, value, reply->hdr.val_len, cookie);
+    return cb != NULL;
+}
+
+/* Fail the requests whose deadline is over, the server drops them or its
+ * late replies are dropped by the id lookup. Return the callbacks run.
+ */
+static int property_async_expire(struct property_async* async)
+{
+    struct property_async_op** prev = &async->ops;
+    struct property_async_op* expired = NULL;
+    struct property_async_op* pending;
+    int64_t now = kvdb_uptime_ms();
+    int count = 0;
+
+    /* Take them out first, the callbacks may submit or unmonitor */
+
+    while ((pending = *prev) != NULL) {
+        if (pending->deadline == 0 || pending->deadline > now) {
+            prev = &pending->next;
+            continue;
+        }
+
+        *prev = pending->next;
+        pending->next = expired;
+        expired = pending;
+    }
+
+    while ((pending = expired) != NULL) {
+        expired = pending->next;
+        if (pending->cb) {
+            pending->cb(-ETIMEDOUT, NULL, NULL, 0, pending->cookie);
+            count++;
+        }
+
+        free(pending);
+    }
+
+    return count;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: property_async_open
+ *
+ * Description:
+ *   Open a session to the server for non-blocking requests.
+ *
+ * Returned Value:
+ *   On success returns the session handle.
+ *   On failure returns NULL and sets errno.
+ *
+ ****************************************************************************/
+
+struct property_async* property_async_open(void)
+{
+    struct property_async* async = calloc(1, sizeof(struct property_async));
+    if (async == NULL)
+        return NULL;
+
+    async->timeout = -1;
+    async->fd = property_connect();
+    if (async->fd < 0) {
+        KVERR("connect failed, fd=%d\n", async->fd);
+        errno = -async->fd;
+        free(async);
+        return NULL;
+    }
+
+    /*---*
+     | 1 |
+     | --|
+     |'P'|
+     *---*/
+
+    if (send(async->fd, "P", 1, 0) < 0) {
+        int err = errno;
+        close(async->fd);
+        free(async);
+        errno = err;
+        return NULL;
+    }
+
+    return async;
+}
+
+/****************************************************************************
+ * Name: property_async_fd
+ *
+ * Description:
+ *   Get the fd to add to poll/epoll, call property_async_dispatch() when it
+ *   becomes readable.
+ *
+ ****************************************************************************/
+
+int property_async_fd(struct property_async* async)
+{
+    return async ? async->fd : -EINVAL;
+}
+
+/****************************************************************************
+ * Name: property_async_deadline
+ *
+ * Description:
+ *   Give the requests submitted next a deadline of timeout ms, <0 for none.
+ *   The server does not serve one whose time is over and it fails with
+ *   -ETIMEDOUT in property_async_dispatch(). Subscriptions take no
+ *   deadline.
+ *
+ ****************************************************************************/
+
+int property_async_deadline(struct property_async* async, int timeout)
+{
+    if (!async)
+        return -EINVAL;
+
+    async->timeout = timeout;
+    return 0;
+}
+
+/****************************************************************************
+ * Name: property_async_timeout
+ *
+ * Description:
+ *   Get the ms until the next deadline of a pending request, the timeout
+ *   to poll the fd with. property_async_dispatch() fails the request once
+ *   it is over.
+ *
+ * Returned Value:
+ *   The ms left, 0 if one is over, -1 if there is no deadline.
+ *
+ ****************************************************************************/
+
+int property_async_timeout(struct property_async* async)
+{
+    int64_t next = 0;
+
+    if (!async)
+        return -1;
+
+    for (struct property_async_op* pending = async->ops; pending; pending = pending->next) {
+        if (pending->deadline && (next == 0 || pending->deadline < next))
+            next = pending->deadline;
+    }
+
+    if (next == 0)
+        return -1;
+
+    return MAX(next - kvdb_uptime_ms(), 0);
+}
+
+/****************************************************************************
+ * Name: property_async_get
+ *
+ * Description:
+ *   Submit a get, cb receives the length of the value or -errno.
+ *
+ * Returned Value:
+ *   On success returns the request id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_get(struct property_async* async, const char* key,
+    property_async_cb cb, void* cookie)
+{
+    if (!key)
+        return -EINVAL;
+
+    return property_async_submit(async, 'G', key, NULL, 0, false, 0, cb, cookie);
+}
+
+/****************************************************************************
+ * Name: property_async_set
+ *
+ * Description:
+ *   Submit a set, cb receives 0 or -errno.
+ *
+ * Returned Value:
+ *   On success returns the request id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_set(struct property_async* async, const char* key,
+    const void* value, size_t val_len, property_async_cb cb, void* cookie)
+{
+    if (!key || !value || val_len == 0)
+        return -EINVAL;
+
+    return property_async_submit(async, 'S', key, value, val_len, false, 0, cb, cookie);
+}
+
+/****************************************************************************
+ * Name: property_async_delete
+ *
+ * Description:
+ *   Submit a delete, cb receives 0 or -errno.
+ *
+ * Returned Value:
+ *   On success returns the request id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_delete(struct property_async* async, const char* key,
+    property_async_cb cb, void* cookie)
+{
+    if (!key)
+        return -EINVAL;
+
+    return property_async_submit(async, 'D', key, NULL, 0, false, 0, cb, cookie);
+}
+
+/****************************************************************************
+ * Name: property_async_commit
+ *
+ * Description:
+ *   Submit a commit, cb receives 0 or -errno.
+ *
+ * Returned Value:
+ *   On success returns the request id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_commit(struct property_async* async, property_async_cb cb, void* cookie)
+{
+    return property_async_submit(async, 'C', NULL, NULL, 0, false, 0, cb, cookie);
+}
+
+/****************************************************************************
+ * Name: property_async_monitor
+ *
+ * Description:
+ *   Subscribe to the keys matching the fnmatch pattern. cb receives every
+ *   change with the key and the new value (val_len 0 on delete), or once
+ *   -errno if the subscription is refused.
+ *
+ * Returned Value:
+ *   On success returns the subscription id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_monitor(struct property_async* async, const char* key,
+    property_async_cb cb, void* cookie)
+{
+    if (!key)
+        return -EINVAL;
+
+    return property_async_submit(async, 'M', key, NULL, 0, true, 0, cb, cookie);
+}
+
+/****************************************************************************
+ * Name: property_async_watch
+ *
+ * Description:
+ *   Subscribe like property_async_monitor(), cb receives the time of every
+ *   change on the server instead of the length of the value, and once the
+ *   current time with a NULL key when the subscription is in place.
+ *
+ * Returned Value:
+ *   On success returns the subscription id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_watch(struct property_async* async, const char* key,
+    property_async_cb cb, void* cookie)
+{
+    if (!key)
+        return -EINVAL;
+
+    return property_async_submit(async, 'M', key, NULL, 0, true, KVDB_FLAG_STAMP, cb, cookie);
+}
+
+/****************************************************************************
+ * Name: property_async_unmonitor
+ *
+ * Description:
+ *   Drop a subscription made by property_async_monitor(), the session and
+ *   its other subscriptions stay. The monitor callback is not called any
+ *   more once this returns, cb receives 0 or -errno from the server.
+ *
+ * Returned Value:
+ *   On success returns the request id (>0), -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_async_unmonitor(struct property_async* async, int id,
+    property_async_cb cb, void* cookie)
+{
+    struct property_async_op** prev;
+    struct property_async_op* pending;
+    uint32_t sub = id;
+
+    if (!async || id <= 0)
+        return -EINVAL;
+
+    for (prev = &async->ops; (pending = *prev) != NULL; prev = &pending->next) {
+        if (pending->id == sub && pending->monitor)
+            break;
+    }
+
+    if (pending == NULL)
+        return -ENOENT;
+
+    int ret = property_async_submit(async, 'U', NULL, &sub, sizeof(sub), false, 0, cb, cookie);
+    if (ret < 0)
+        return ret;
+
+    /* Notifications still in flight for it are dropped by the id lookup,
+     * look it up again since submit pushed the new request in front.
+     */
+
+    for (prev = &async->ops; *prev != pending; prev = &(*prev)->next)
+        ;
+
+    *prev = pending->next;
+    free(pending);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: property_async_dispatch
+ *
+ * Description:
+ *   Receive whatever the server sent so far and run the callbacks, never
+ *   blocks. Then fail the requests whose deadline is over with -ETIMEDOUT.
+ *   Callbacks may submit new requests but must not close async.
+ *
+ * Returned Value:
+ *   On success returns the number of callbacks run.
+ *   On failure returns -errno, -ENOTCONN once the server is gone.
+ *
+ ****************************************************************************/
+
+int property_async_dispatch(struct property_async* async)
+{
+    int count = 0;
+
+    if (!async)
+        return -EINVAL;
+
+    while (1) {
+        ssize_t ret = recv(async->fd, async->rx + async->len,
+            sizeof(async->rx) - async->len, MSG_DONTWAIT);
+        if (ret == 0)
+            return -ENOTCONN;
+        else if (ret < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK
+                ? count + property_async_expire(async)
+                : -errno;
+
+        async->len += ret;
+
+        size_t pos = 0;
+        while (async->len - pos >= sizeof(struct kvdb_reply)) {
+            struct kvdb_reply reply;
+
+            memcpy(&reply, async->rx + pos, sizeof(reply));
+            size_t total = sizeof(reply) + reply.hdr.key_len + reply.hdr.val_len;
+            if (async->len - pos < total)
+                break;
+
+            if (property_async_complete(async, &reply, async->rx + pos + sizeof(reply)))
+                count++;
+            pos += total;
+        }
+
+        async->len -= pos;
+        memmove(async->rx, async->rx + pos, async->len);
+    }
+}
+
+/****************************************************************************
+ * Name: property_async_close
+ *
+ * Description:
+ *   Close the session, outstanding callbacks are dropped.
+ *
+ ****************************************************************************/
+
+void property_async_close(struct property_async* async)
+{
+    if (!async)
+        return;
+
+    while (async->ops) {
+        struct property_async_op* pending = async->ops;
+        async->ops = pending->next;
+        free(pending);
+    }
+
+    close(async->fd);
+    free(async);
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/param.h>
+
+#include <kvdb.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* The backend and the transport are chosen at build time, report them so
+ * results of different builds can be told apart.
+ */
+
+#if defined(CONFIG_KVDB_NVS)
+#define KVBENCH_BACKEND "nvs"
+#elif defined(CONFIG_KVDB_UNQLITE)
+#define KVBENCH_BACKEND "unqlite"
+#elif defined(CONFIG_KVDB_FILE)
+#define KVBENCH_BACKEND "file"
+#else
+#define KVBENCH_BACKEND "remote"
+#endif
+
+#if defined(CONFIG_KVDB_DIRECT)
+#define KVBENCH_TRANSPORT "direct"
+#elif defined(CONFIG_KVDB_SERVER)
+#define KVBENCH_TRANSPORT "local"
+#elif defined(CONFIG_KVDB_REPLICA)
+#define KVBENCH_TRANSPORT "replica"
+#else
+#define KVBENCH_TRANSPORT "rpmsg"
+#endif
+
+#ifdef CONFIG_KVDB_DUMPLIST
+#define KVBENCH_TESTS "set,get,mix,list,commit,delete"
+#else
+#define KVBENCH_TESTS "set,get,mix,commit,delete"
+#endif
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef struct kvbench {
+    const char* prefix;
+    size_t keys;
+    size_t loops;
+    size_t val_len;
+    int write_pct;
+    bool csv;
+    char* value;
+    uint32_t* lat; /* latency of every operation (us) */
+    size_t count;
+    size_t errors;
+} kvbench;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static uint64_t kvbench_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int kvbench_compare(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void kvbench_key(kvbench* bench, size_t i, char* key)
+{
+    snprintf(key, PROP_NAME_MAX, "%s%zu", bench->prefix, i);
+}
+
+static void kvbench_record(kvbench* bench, uint64_t start, int ret)
+{
+    bench->lat[bench->count++] = kvbench_now_us() - start;
+    if (ret < 0)
+        bench->errors++;
+}
+
+static void kvbench_report(kvbench* bench, const char* test, uint64_t elapsed)
+{
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    uint32_t max = 0;
+
+    if (bench->count) {
+        qsort(bench->lat, bench->count, sizeof(uint32_t), kvbench_compare);
+        p50 = bench->lat[(bench->count - 1) * 50 / 100];
+        p99 = bench->lat[(bench->count - 1) * 99 / 100];
+        max = bench->lat[bench->count - 1];
+    }
+
+    uint64_t ops = elapsed ? bench->count * 1000000ull / elapsed : 0;
+
+    if (bench->csv) {
+        printf("%s,%s,%s,%zu,%zu,%d,%zu,%zu,%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+            KVBENCH_BACKEND, KVBENCH_TRANSPORT, test, bench->keys, bench->val_len,
+            bench->write_pct, bench->count, bench->errors, ops, p50, p99, max);
+    } else {
+        printf("{\"backend\":\"%s\",\"transport\":\"%s\",\"test\":\"%s\","
+               "\"keys\":%zu,\"value_size\":%zu,\"write_pct\":%d,"
+               "\"ops\":%zu,\"errors\":%zu,\"ops_per_sec\":%" PRIu64 ","
+               "\"p50_us\":%" PRIu32 ",\"p99_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}\n",
+            KVBENCH_BACKEND, KVBENCH_TRANSPORT, test, bench->keys, bench->val_len,
+            bench->write_pct, bench->count, bench->errors, ops, p50, p99, max);
+    }
+}
+
+static void kvbench_list_consume(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    UNUSED(key);
+    UNUSED(value);
+    UNUSED(val_len);
+    UNUSED(cookie);
+}
+
+static void kvbench_run(kvbench* bench, const char* test)
+{
+    char key[PROP_NAME_MAX];
+    char buf[PROP_VALUE_MAX];
+    size_t loops = bench->loops;
+
+    if (!strcmp(test, "list") || !strcmp(test, "commit"))
+        loops = MAX(loops / 10, 1);
+    else if (!strcmp(test, "delete"))
+        loops = 1;
+
+    bench->count = 0;
+    bench->errors = 0;
+    srand(1);
+
+    uint64_t begin = kvbench_now_us();
+
+    for (size_t n = 0; n < loops; n++) {
+        if (!strcmp(test, "list")) {
+            uint64_t start = kvbench_now_us();
+            kvbench_record(bench, start, property_list_binary(kvbench_list_consume, NULL));
+            continue;
+        } else if (!strcmp(test, "commit")) {
+            uint64_t start = kvbench_now_us();
+            kvbench_record(bench, start, property_commit());
+            continue;
+        }
+
+        for (size_t i = 0; i < bench->keys; i++) {
+            bool write = !strcmp(test, "set")
+                || (!strcmp(test, "mix") && rand() % 100 < bench->write_pct);
+            size_t k = !strcmp(test, "mix") ? (size_t)rand() % bench->keys : i;
+            uint64_t start;
+            int ret;
+
+            kvbench_key(bench, k, key);
+            start = kvbench_now_us();
+            if (!strcmp(test, "delete"))
+                ret = property_delete(key);
+            else if (write)
+                ret = property_set_binary(key, bench->value, bench->val_len, false);
+            else
+                ret = property_get_binary(key, buf, sizeof(buf));
+            kvbench_record(bench, start, ret);
+        }
+    }
+
+    kvbench_report(bench, test, kvbench_now_us() - begin);
+}
+
+static void kvbench_usage(const char* progname)
+{
+    printf("Usage: %s [-n keys] [-s value size] [-l loops] [-w write%%]\n"
+           "       [-p key prefix] [-t tests] [-c]\n"
+           "  -n  number of keys, default 100\n"
+           "  -s  value size in bytes, default 32\n"
+           "  -l  passes over the keys per test, default 10\n"
+           "  -w  percentage of sets in the mix test, default 10\n"
+           "  -p  key prefix, default \"bench.\", \"persist.bench.\" for the\n"
+           "      persistent store\n"
+           "  -t  comma separated tests, default " KVBENCH_TESTS "\n"
+           "  -c  print csv instead of json lines\n",
+        progname);
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    kvbench bench = {
+        .prefix = "bench.",
+        .keys = 100,
+        .loops = 10,
+        .val_len = 32,
+        .write_pct = 10,
+    };
+    char tests[64] = KVBENCH_TESTS;
+    int ret = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:l:w:p:t:ch")) != -1) {
+        switch (opt) {
+        case 'n':
+            bench.keys = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            bench.val_len = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            bench.loops = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            bench.write_pct = atoi(optarg);
+            break;
+        case 'p':
+            bench.prefix = optarg;
+            break;
+        case 't':
+            strlcpy(tests, optarg, sizeof(tests));
+            break;
+        case 'c':
+            bench.csv = true;
+            break;
+        default:
+            kvbench_usage(argv[0]);
+            return opt == 'h' ? 0 : -EINVAL;
+        }
+    }
+
+    if (bench.keys == 0 || bench.loops == 0 || bench.val_len == 0
+        || bench.val_len >= PROP_VALUE_MAX || strlen(bench.prefix) + 11 > PROP_NAME_MAX) {
+        kvbench_usage(argv[0]);
+        return -EINVAL;
+    }
+
+    bench.value = malloc(bench.val_len);
+    bench.lat = malloc(bench.keys * bench.loops * sizeof(uint32_t));
+    if (bench.value == NULL || bench.lat == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    memset(bench.value, 'v', bench.val_len - 1);
+    bench.value[bench.val_len - 1] = '\0';
+
+    if (bench.csv)
+        printf("backend,transport,test,keys,value_size,write_pct,ops,errors,ops_per_sec,p50_us,p99_us,max_us\n");
+
+    char* saveptr;
+    for (char* test = strtok_r(tests, ",", &saveptr); test;
+         test = strtok_r(NULL, ",", &saveptr)) {
+        char name[16];
+
+        snprintf(name, sizeof(name), ",%s,", test);
+        if (strstr("," KVBENCH_TESTS ",", name) == NULL) {
+            fprintf(stderr, "unknown test %s\n", test);
+            ret = -EINVAL;
+            break;
+        }
+
+        kvbench_run(&bench, test);
+    }
+
+out:
+    free(bench.lat);
+    free(bench.value);
+    return ret;
+}
@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include <netpacket/rpmsg.h>
+#include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/un.h>
@@ -35,6 +36,18 @@
 
 #include "internal.h"
 
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+/* The longest wait between two tries to connect to a server not up yet */
+
+#define KVDB_CONNECT_BACKOFF_MAX 64
+
+#ifndef CONFIG_KVDB_CONNECT_TIMEOUT
+#define CONFIG_KVDB_CONNECT_TIMEOUT 0
+#endif
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
@@ -54,21 +67,23 @@ static ssize_t recv_safe(int sockfd, char* buf, size_t offset, size_t len)
 }
 
 /****************************************************************************
- * Name: property_connect
+ * Name: property_connect_timeout
  *
  * Description:
- *   Initialize client socket and connect to server
+ *   Initialize client socket and connect to server, waiting for the server
+ *   to start. The retries back off from 1 ms up to
+ *   KVDB_CONNECT_BACKOFF_MAX ms.
  *
  * Input Parameters:
- *   None
+ *   int timeout: the most ms to wait for the server, <0 waits forever
  *
  * Returned Value:
  *   On success return client socket fd.
- *   On error return error value (<0).
+ *   On error return error value (<0), -ETIMEDOUT once timeout is over.
  *
  ****************************************************************************/
 
-static int property_connect(void)
+int property_connect_timeout(int timeout)
 {
 #ifdef CONFIG_KVDB_SERVER
     int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -79,12 +94,12 @@ static int property_connect(void)
         return -errno;
 
 #if CONFIG_KVDB_TIMEOUT_INTERVAL
-    struct timeval timeout = {
+    struct timeval interval = {
         .tv_sec = CONFIG_KVDB_TIMEOUT_INTERVAL,
         .tv_usec = 0,
     };
-    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &interval, sizeof(interval));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &interval, sizeof(interval));
 #endif
 
 #ifdef CONFIG_KVDB_SERVER
@@ -100,6 +115,9 @@ static int property_connect(void)
     };
 #endif
 
+    int64_t deadline = timeout >= 0 ? kvdb_uptime_ms() + timeout : 0;
+    int delay = 1;
+
     while (1) {
         int ret = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
         if (ret < 0 && errno != ENOENT) {
@@ -110,8 +128,153 @@ static int property_connect(void)
             return fd;
         }
 
-        usleep(1000);
+        /* Not up yet, never sleep past the deadline */
+
+        if (timeout >= 0) {
+            int64_t left = deadline - kvdb_uptime_ms();
+            if (left <= 0) {
+                close(fd);
+                return -ETIMEDOUT;
+            }
+
+            delay = MIN(delay, left);
+        }
+
+        usleep(delay * 1000);
+        delay = MIN(delay * 2, KVDB_CONNECT_BACKOFF_MAX);
+    }
+}
+
+/****************************************************************************
+ * Name: property_connect
+ *
+ * Description:
+ *   Connect to server, waiting CONFIG_KVDB_CONNECT_TIMEOUT ms for it to
+ *   start, or forever if 0.
+ *
+ ****************************************************************************/
+
+int property_connect(void)
+{
+    return property_connect_timeout(CONFIG_KVDB_CONNECT_TIMEOUT ? CONFIG_KVDB_CONNECT_TIMEOUT : -1);
+}
+
+#ifdef CONFIG_KVDB_REPLICA
+/* Gets, sets and deletes go to kvdbr on this core if it runs, it serves
+ * the gets from its copy and forwards the rest to kvdbd.
+ */
+
+static int property_connect_replica(void)
+{
+    const struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+        .sun_path = PROP_REPLICA_PATH,
+    };
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return property_connect();
+
+    if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return property_connect();
+    }
+
+    return fd;
+}
+#else
+#define property_connect_replica property_connect
+#endif
+
+/* Send a request with a deadline on a session of its own, the server drops
+ * it instead of serving it late. Gets go to kvdbd even with a replica, it
+ * is the one which knows how long a request waited. out receives the value
+ * of a get.
+ */
+
+static ssize_t property_request_timeout(char op, const char* key,
+    const void* value, size_t val_len, void* out, size_t out_len, int timeout)
+{
+    int64_t deadline = kvdb_uptime_ms() + timeout;
+    size_t key_len = strlen(key) + 1;
+    struct kvdb_reply reply;
+    char buf[PROP_VALUE_MAX];
+    ssize_t ret;
+
+    int fd = property_connect_timeout(timeout);
+    if (fd < 0) {
+        KVERR("connect failed, fd=%d\n", fd);
+        return fd;
+    }
+
+    /* The server drops the request past the deadline, what is left of
+     * the time bounds the wait for its reply.
+     */
+
+    int64_t left = deadline - kvdb_uptime_ms();
+    if (left <= 0) {
+        ret = -ETIMEDOUT;
+        goto out;
+    }
+
+    struct timeval interval = {
+        .tv_sec = left / 1000,
+        .tv_usec = left % 1000 * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &interval, sizeof(interval));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &interval, sizeof(interval));
+
+    /*----------------------------------------*
+     | 1 |  8  | key_len | val_len |    4     |
+     |----------------------------------------|
+     |'P'|frame|[key'\0']| [value] | deadline |
+     *----------------------------------------*/
+
+    struct kvdb_frame req = {
+        .op = op,
+        .key_len = key_len,
+        .val_len = val_len,
+        .flags = KVDB_FLAG_DEADLINE,
+        .id = 1,
+    };
+    uint32_t until = kvdb_deadline(deadline);
+
+    struct iovec iov[5] = {
+        { .iov_base = "P", .iov_len = 1 },
+        { .iov_base = &req, .iov_len = sizeof(req) },
+        { .iov_base = (char*)key, .iov_len = key_len },
+        { .iov_base = (char*)value, .iov_len = val_len },
+        { .iov_base = &until, .iov_len = sizeof(until) },
+    };
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 5;
+
+    ret = sendmsg(fd, &msg, 0);
+    if (ret < 0) {
+        ret = errno == EAGAIN ? -ETIMEDOUT : -errno;
+        KVERR("sendmsg failed, ret=%zd\n", ret);
+        goto out;
+    }
+
+    ret = recv_safe(fd, (char*)&reply, 0, sizeof(reply));
+    if (ret >= 0 && reply.hdr.val_len)
+        ret = recv_safe(fd, buf, 0, reply.hdr.val_len);
+    if (ret < 0) {
+        ret = ret == -EAGAIN ? -ETIMEDOUT : ret;
+        goto out;
+    }
+
+    ret = reply.err;
+    if (ret >= 0 && out) {
+        ret = MIN(reply.hdr.val_len, out_len);
+        memcpy(out, buf, ret);
     }
+
+out:
+    close(fd);
+    return ret;
 }
 
 /****************************************************************************
@@ -150,7 +313,7 @@ int property_set_binary(const char* key, const void* value, size_t val_len, bool
         return -E2BIG;
 
 again:
-    fd = property_connect();
+    fd = property_connect_replica();
     if (fd < 0) {
         KVERR("connect failed, fd=%d\n", fd);
         return fd;
@@ -214,6 +377,94 @@ out:
     return ret;
 }
 
+/****************************************************************************
+ * Name: property_set_ttl
+ *
+ * Description:
+ *   Store a volatile Key-Value which the server deletes after ttl ms, the
+ *   monitors see the delete. Setting or deleting the key again before
+ *   makes it stay.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string, not a "persist." one
+ *   const void* value: entry value string
+ *   size_t val_len: the length of the value
+ *   uint32_t ttl: the time to live (in milliseconds)
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_set_ttl(const char* key, const void* value, size_t val_len, uint32_t ttl)
+{
+    if (!key || ttl == 0)
+        return -EINVAL;
+
+    size_t key_len = strlen(key) + 1;
+    if (key_len > PROP_NAME_MAX)
+        return -E2BIG;
+
+    if (val_len == 0 || val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    int fd = property_connect();
+    if (fd < 0) {
+        KVERR("connect failed, fd=%d\n", fd);
+        return fd;
+    }
+
+    /*-------------------------------------------*
+     | 1 |   1   |   1   | 4 | key_len |val_len|
+     |-------------------------------------------|
+     |'E'|key_len|val_len|ttl|[key'\0']|[value]|
+     *-------------------------------------------*/
+
+    char cmd[7] = {
+        'E', key_len, val_len
+    };
+
+    memcpy(cmd + 3, &ttl, 4);
+
+    struct iovec iov[3] = {
+        { .iov_base = cmd, .iov_len = 7 },
+        { .iov_base = (char*)key, .iov_len = key_len },
+        { .iov_base = (char*)value, .iov_len = val_len },
+    };
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    int ret = sendmsg(fd, &msg, 0);
+    if (ret < 0) {
+        ret = -errno;
+        KVERR("sendmsg failed, ret=%d\n", ret);
+        goto out;
+    }
+
+    /*-----*
+     |  4  |
+     |-----|
+     |error|
+     *-----*/
+
+    int32_t err;
+    ret = recv(fd, &err, 4, 0);
+    if (ret < 4) {
+        KVERR("recv failed, ret=%d\n", ret);
+        ret = ret < 0 ? -errno : -ENOTSUP; /* no reply from a server without TTL */
+        goto out;
+    }
+
+    ret = err;
+
+out:
+    close(fd);
+    return ret;
+}
+
 /****************************************************************************
  * Name: property_get_binary
  *
@@ -241,7 +492,7 @@ ssize_t property_get_binary(const char* key, void* value, size_t val_len)
     if (key_len > PROP_NAME_MAX)
         return -EINVAL;
 
-    int fd = property_connect();
+    int fd = property_connect_replica();
     if (fd < 0) {
         KVERR("connect failed, fd=%d\n", fd);
         return fd;
@@ -308,6 +559,89 @@ out:
     return len < 0 ? -errno : len;
 }
 
+/****************************************************************************
+ * Name: property_get_binary_timeout
+ *
+ * Description:
+ *   Retrieve Key-Values from database like property_get_binary(), giving up
+ *   after timeout ms. The server does not serve the request once the
+ *   caller stopped waiting for it.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   void* value: not NULL : pointer to string buffer
+ *                NULL     : check whether this [key, value] exists
+ *   size_t val_len: the length of the value
+ *   int timeout: the most ms to wait, the connection included, <0 forever
+ *
+ * Returned Value:
+ *   On success returns the length of the value.
+ *   On failure returns -errno, -ETIMEDOUT once the time is over.
+ *
+ ****************************************************************************/
+
+ssize_t property_get_binary_timeout(const char* key, void* value, size_t val_len, int timeout)
+{
+    if (!key)
+        return -EINVAL;
+
+    if (strlen(key) + 1 > PROP_NAME_MAX)
+        return -EINVAL;
+
+    /* in environment variable? */
+    ssize_t ret = kvdb_env_get(key, value, val_len);
+    if (ret != -ENOENT)
+        return ret;
+
+    if (timeout < 0)
+        return property_get_binary(key, value, val_len);
+
+    return property_request_timeout('G', key, NULL, 0, value, val_len, timeout);
+}
+
+/****************************************************************************
+ * Name: property_set_binary_timeout
+ *
+ * Description:
+ *   Store Key-Values to database like property_set_binary(), giving up
+ *   after timeout ms. The server does not apply the set once the caller
+ *   stopped waiting for it, one which reached it in time may still be
+ *   applied when the reply comes too late.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   const void* value: entry value string
+ *   size_t val_len: the length of the value
+ *   int timeout: the most ms to wait, the connection included, <0 forever
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution, -ETIMEDOUT once the time is over
+ *
+ ****************************************************************************/
+
+int property_set_binary_timeout(const char* key, const void* value, size_t val_len, int timeout)
+{
+    if (!key || !value)
+        return -EINVAL;
+
+    if (strlen(key) + 1 > PROP_NAME_MAX)
+        return -E2BIG;
+
+    if (val_len == 0 || val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    /* in environment variable? */
+    int ret = kvdb_env_set(key, value, val_len);
+    if (ret != -ENOENT)
+        return ret;
+
+    if (timeout < 0)
+        return property_set_binary(key, value, val_len, false);
+
+    return property_request_timeout('S', key, value, val_len, NULL, 0, timeout);
+}
+
 /****************************************************************************
  * Name: property_delete
  *
@@ -333,14 +667,14 @@ int property_delete(const char* key)
         return -E2BIG;
 
     /* in environment variable? */
-    if (getenv(key)) {
+    if (kvdb_getenv(key)) {
         int ret = unsetenv(key);
         if (ret < 0)
             ret = -errno;
         return ret;
     }
 
-    int fd = property_connect();
+    int fd = property_connect_replica();
     if (fd < 0) {
         KVERR("connect failed, fd=%d\n", fd);
         return fd;
@@ -393,22 +727,9 @@ out:
     return ret;
 }
 
-/****************************************************************************
- * Name: property_list_binary
- *
- * Description:
- *   List all KVs in every database and calls callback function.
- *
- * Input Parameters:
- *   property_callback propfn: callback function
- *   void* cookie: cookie data to pass to callback function
- *
- * Returned Value:
- *   Returns 0 on success, <0 if all databases failed to open.
- *
- ****************************************************************************/
-
-int property_list_binary(void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
+/* Send the request and pass the returned pairs to propfn */
+static int property_dump(const char* req, size_t len,
+    void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
 {
     char* msg = NULL;
 
@@ -418,13 +739,13 @@ int property_list_binary(void (*propfn)(const char* key, const void* value, size
         return fd;
     }
 
-    /*---*
-     | 1 |
-     | --|
-     |'L'|
-     *---*/
+    /*-----------------------------*
+     |       1       |     [1]     |
+     | ----------------------------|
+     |'L','I','T','K'| [trace mode]|
+     *-----------------------------*/
 
-    int ret = send(fd, "L", 1, 0);
+    int ret = send(fd, req, len, 0);
     if (ret < 0) {
         ret = -errno;
         KVERR("send failed, ret=%d\n", ret);
@@ -447,7 +768,6 @@ int property_list_binary(void (*propfn)(const char* key, const void* value, size
 
         ret = recv_safe(fd, msg, 0, 2);
         if (ret < 0) {
-            ret = -errno;
             KVERR("recv_safe failed, ret=%d\n", ret);
             goto out;
         }
@@ -488,38 +808,214 @@ out:
 }
 
 /****************************************************************************
- * Name: property_wait
+ * Name: property_list_binary
  *
  * Description:
- *   Wait the monitored key until its value updated or key deleted.
+ *   List all KVs in every database and calls callback function.
  *
  * Input Parameters:
- *   const char* key     : the monitored key string, support fnmatch pattern
- *   char*       newkey  : pointer to a string buffer to receive the key of
- *                         the updated/deleted value
- *   void*       newvalue: pointer to a string buffer to receive the updated
- *                         value or deleted value
- *   size_t      val_len : the length of the newvalue
- *   int         timeout : the wait timeout time (in milliseconds)
+ *   property_callback propfn: callback function
+ *   void* cookie: cookie data to pass to callback function
  *
  * Returned Value:
- *   On success returns the length of the value.
+ *   Returns 0 on success, <0 if all databases failed to open.
  *
  ****************************************************************************/
 
-ssize_t property_wait(const char* key, char* newkey, void* newvalue, size_t val_len, int timeout)
+int property_list_binary(void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
 {
-    if (key == NULL)
-        return -EINVAL;
-
-    int fd = property_monitor_open(key);
-    if (fd < 0)
-        return fd;
+    return property_dump("L", 1, propfn, cookie);
+}
 
-    struct pollfd fds = {
-        .fd = fd,
-        .events = POLLIN
-    };
+/****************************************************************************
+ * Name: property_stats
+ *
+ * Description:
+ *   Read the server statistics, every counter is passed to the callback
+ *   as a name and a string value.
+ *
+ * Input Parameters:
+ *   property_callback propfn: callback function
+ *   void* cookie: cookie data to pass to callback function
+ *
+ * Returned Value:
+ *   Returns 0 on success, <0 if the server doesn't keep statistics.
+ *
+ ****************************************************************************/
+
+int property_stats(void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
+{
+    return property_dump("T", 1, propfn, cookie);
+}
+
+/****************************************************************************
+ * Name: property_trace
+ *
+ * Description:
+ *   Read the requests sampled by the server. Raw passes every sample as
+ *   "<ms> <peer> <op> <latency us> <key>", otherwise the samples of the
+ *   same peer, op and key are merged into "<count> <peer> <op> <average
+ *   latency us> <key>", the busiest first.
+ *
+ * Input Parameters:
+ *   int raw: pass the samples one by one
+ *   property_callback propfn: callback function
+ *   void* cookie: cookie data to pass to callback function
+ *
+ * Returned Value:
+ *   Returns 0 on success, <0 if the server doesn't trace.
+ *
+ ****************************************************************************/
+
+int property_trace(int raw, void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
+{
+    return property_dump(raw ? "Kr" : "Ka", 2, propfn, cookie);
+}
+
+/****************************************************************************
+ * Name: property_atomic_binary
+ *
+ * Description:
+ *   Perform a read-modify-write on the server in one round-trip.
+ *
+ * Input Parameters:
+ *   int type: one of PROPERTY_ATOMIC_*
+ *   const char* key: entry key string
+ *   const void* arg, size_t arg_len: the operation argument
+ *   const void* value, size_t val_len: the value to store
+ *   void* out, size_t out_len: buffer to receive the resulting value
+ *   uint32_t* serial: receive the serial of the key
+ *
+ * Returned Value:
+ *   On success returns the length of the value copied to out.
+ *   On failure returns -errno.
+ *
+ ****************************************************************************/
+
+ssize_t property_atomic_binary(int type, const char* key, const void* arg, size_t arg_len,
+    const void* value, size_t val_len, void* out, size_t out_len, uint32_t* serial)
+{
+    if (!key)
+        return -EINVAL;
+
+    size_t key_len = strlen(key) + 1;
+    if (key_len > PROP_NAME_MAX)
+        return -E2BIG;
+
+    if (arg_len >= PROP_VALUE_MAX || val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    int fd = property_connect();
+    if (fd < 0) {
+        KVERR("connect failed, fd=%d\n", fd);
+        return fd;
+    }
+
+    /*-------------------------------------------------------------*
+     | 1 |  1 |   1   |   1   |   1   | key_len |arg_len|val_len|
+     |-------------------------------------------------------------|
+     |'X'|type|key_len|arg_len|val_len|[key'\0']| [arg] |[value]|
+     *-------------------------------------------------------------*/
+
+    char cmd[5] = {
+        'X', type, key_len, arg_len, val_len
+    };
+
+    struct iovec iov[4] = {
+        { .iov_base = cmd, .iov_len = 5 },
+        { .iov_base = (char*)key, .iov_len = key_len },
+        { .iov_base = (char*)arg, .iov_len = arg_len },
+        { .iov_base = (char*)value, .iov_len = val_len },
+    };
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 4;
+
+    char* buf = NULL;
+    ssize_t ret = sendmsg(fd, &msg, 0);
+    if (ret < 0) {
+        ret = -errno;
+        KVERR("sendmsg failed, ret=%zd\n", ret);
+        goto out;
+    }
+
+    /*-----------------------------*
+     |  4  |   4  |  1  |   len   |
+     |-----------------------------|
+     |error|serial| len |[value]  |
+     *-----------------------------*/
+
+    buf = malloc(9 + PROP_VALUE_MAX);
+    if (buf == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = recv_safe(fd, buf, 0, 9);
+    if (ret < 0) {
+        KVERR("recv_safe failed, ret=%zd\n", ret);
+        goto out;
+    }
+
+    size_t len = (unsigned char)buf[8];
+    ret = recv_safe(fd, buf, 9, 9 + len);
+    if (ret < 0) {
+        KVERR("recv_safe failed, ret=%zd\n", ret);
+        goto out;
+    }
+
+    int32_t err;
+    memcpy(&err, buf, 4);
+    if (serial)
+        memcpy(serial, buf + 4, 4);
+
+    if (out) {
+        len = MIN(len, out_len);
+        memcpy(out, buf + 9, len);
+    }
+
+    ret = err < 0 ? err : (ssize_t)len;
+
+out:
+    free(buf);
+    close(fd);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: property_wait
+ *
+ * Description:
+ *   Wait the monitored key until its value updated or key deleted.
+ *
+ * Input Parameters:
+ *   const char* key     : the monitored key string, support fnmatch pattern
+ *   char*       newkey  : pointer to a string buffer to receive the key of
+ *                         the updated/deleted value
+ *   void*       newvalue: pointer to a string buffer to receive the updated
+ *                         value or deleted value
+ *   size_t      val_len : the length of the newvalue
+ *   int         timeout : the wait timeout time (in milliseconds)
+ *
+ * Returned Value:
+ *   On success returns the length of the value.
+ *
+ ****************************************************************************/
+
+ssize_t property_wait(const char* key, char* newkey, void* newvalue, size_t val_len, int timeout)
+{
+    if (key == NULL)
+        return -EINVAL;
+
+    int fd = property_monitor_open(key);
+    if (fd < 0)
+        return fd;
+
+    struct pollfd fds = {
+        .fd = fd,
+        .events = POLLIN
+    };
 
     int ret = poll(&fds, 1, timeout);
     if (ret < 0) {
@@ -617,6 +1113,42 @@ out:
     return ret;
 }
 
+/* Receive one monitor entry into msg, the first recv uses flags */
+static ssize_t property_monitor_recv(int fd, char* msg, int flags)
+{
+    /*--------------------------------*
+     |   1   |   1   | key_len |val_len|
+     |---------------------------------|
+     |key_len|val_len|[key'\0']|[value]|
+     *---------------------------------*/
+
+    ssize_t ret = recv(fd, msg, 2, flags);
+    if (ret <= 0) {
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return -EAGAIN;
+
+        KVERR("recv failed, ret=%d, errno=%d\n", ret, errno);
+        return ret < 0 ? -errno : -ENODATA;
+    }
+
+    /* The header may be split once entries are sent back to back */
+
+    ret = recv_safe(fd, msg, ret, 2);
+    if (ret < 0)
+        return ret;
+
+    size_t key_len = (unsigned char)msg[0];
+    size_t len = (unsigned char)msg[1];
+    if (key_len > PROP_NAME_MAX || len > PROP_VALUE_MAX)
+        return -E2BIG;
+
+    ret = recv_safe(fd, msg, 2, key_len + len + 2);
+    if (ret < 0)
+        KVERR("recv_safe failed, ret=%d\n", ret);
+
+    return ret;
+}
+
 /****************************************************************************
  * Name: property_monitor_read
  *
@@ -644,44 +1176,19 @@ ssize_t property_monitor_read(int fd, char* newkey, void* newvalue, size_t val_l
         return -ENOMEM;
     }
 
-    ssize_t ret = recv(fd, msg, 2, 0);
-    if (ret < 2) {
-        KVERR("recv failed, ret=%d, errno=%d\n", ret, errno);
-        free(msg);
-        return ret < 0 ? -errno : -ENODATA;
-    }
-
-    size_t key_len = (unsigned char)msg[0];
-    if (key_len > PROP_NAME_MAX) {
-        free(msg);
-        return -E2BIG;
-    }
-
-    size_t len = (unsigned char)msg[1];
-    if (len > PROP_VALUE_MAX) {
-        free(msg);
-        return -E2BIG;
-    }
-
-    size_t total = key_len + len + 2;
-    ret = recv_safe(fd, msg, ret, total);
+    ssize_t ret = property_monitor_recv(fd, msg, 0);
     if (ret < 0) {
-        KVERR("recv_safe failed, ret=%d\n", ret);
         free(msg);
         return ret;
     }
 
+    size_t key_len = (unsigned char)msg[0];
+    size_t len = (unsigned char)msg[1];
     const char* key = &msg[2];
     if (newkey != NULL)
         strlcpy(newkey, key, PROP_NAME_MAX);
 
     if (newvalue != NULL) {
-        /*--------------------------------*
-         |   1   |   1   | key_len |val_len|
-         |---------------------------------|
-         |key_len|val_len|[key'\0']|[value]|
-         *---------------------------------*/
-
         const void* value = &msg[2 + key_len];
         len = val_len > len ? len : val_len;
         memcpy(newvalue, value, len);
@@ -691,6 +1198,58 @@ ssize_t property_monitor_read(int fd, char* newkey, void* newvalue, size_t val_l
     return len;
 }
 
+/****************************************************************************
+ * Name: property_monitor_read_batch
+ *
+ * Description:
+ *   Wait for the first change, then drain every change already received
+ *   on the channel without blocking again. The server sends the changes
+ *   of one request or coalescing window together, so one call usually
+ *   consumes them all.
+ *
+ * Input Parameters:
+ *   int   fd      : file descriptor returned by property_monitor_open()
+ *   propfn        : called for every change, value is NULL on delete
+ *   void* cookie  : data to pass to propfn
+ *
+ * Returned Value:
+ *   On success returns the number of changes read, -errno otherwise.
+ *
+ ****************************************************************************/
+
+int property_monitor_read_batch(int fd,
+    void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie),
+    void* cookie)
+{
+    int count = 0;
+
+    if (propfn == NULL)
+        return -EINVAL;
+
+    char* msg = malloc(PROP_MSG_MAX);
+    if (msg == NULL) {
+        KVERR("malloc failed\n");
+        return -ENOMEM;
+    }
+
+    while (1) {
+        ssize_t ret = property_monitor_recv(fd, msg, count ? MSG_DONTWAIT : 0);
+        if (ret < 0) {
+            if (count == 0 || ret != -EAGAIN)
+                count = ret;
+            break;
+        }
+
+        size_t key_len = (unsigned char)msg[0];
+        size_t len = (unsigned char)msg[1];
+        propfn(&msg[2], len ? &msg[2 + key_len] : NULL, len, cookie);
+        count++;
+    }
+
+    free(msg);
+    return count;
+}
+
 /****************************************************************************
  * Name: property_monitor_close
  *
@@ -787,3 +1346,179 @@ int property_reload(void)
     close(fd);
     return ret;
 }
+
+/****************************************************************************
+ * Name: property_image_list
+ *
+ * Description:
+ *   Read all the pairs for property_snapshot(), in one request.
+ *
+ ****************************************************************************/
+
+int property_image_list(kvdb_consume consume, void* cookie)
+{
+    return property_dump("I", 1, consume, cookie);
+}
+
+/****************************************************************************
+ * Name: property_image_apply
+ *
+ * Description:
+ *   Send the transaction made of a snapshot image for property_restore().
+ *
+ ****************************************************************************/
+
+int property_image_apply(const char* buf, size_t len)
+{
+    int fd = property_connect();
+    if (fd < 0) {
+        KVERR("connect failed, fd=%d\n", fd);
+        return fd;
+    }
+
+    /*-----------------------------*
+     | 1 |  4 |  size   | 1 |
+     |-----------------------------|
+     |'W'|size|[records]|'E'|
+     *-----------------------------*/
+
+    uint32_t size = len;
+    char cmd[5] = { 'W' };
+    memcpy(cmd + 1, &size, 4);
+
+    struct iovec iov[3] = {
+        { .iov_base = cmd, .iov_len = 5 },
+        { .iov_base = (char*)buf, .iov_len = len },
+        { .iov_base = "E", .iov_len = 1 },
+    };
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    /* a big image goes out in pieces */
+
+    int ret = 0;
+    while (msg.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(fd, &msg, 0);
+        if (sent < 0) {
+            ret = -errno;
+            KVERR("sendmsg failed, ret=%d\n", ret);
+            goto out;
+        }
+
+        while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+
+    /*-----*
+     |  4  |
+     |-----|
+     |error|
+     *-----*/
+
+    int32_t err;
+    ret = recv(fd, &err, 4, 0);
+    if (ret < 4) {
+        KVERR("recv failed, ret=%d\n", ret);
+        ret = ret < 0 ? -errno : -EINVAL;
+        goto out;
+    }
+
+    ret = err;
+
+out:
+    close(fd);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: property_txn_commit
+ *
+ * Description:
+ *   Send all operations of the transaction in one request and release it.
+ *
+ * Input Parameters:
+ *   struct property_txn* txn: handle returned by property_txn_begin()
+ *
+ * Returned Value:
+ *   On success returns 0.
+ *   On failure returns -errno.
+ *
+ ****************************************************************************/
+
+int property_txn_commit(struct property_txn* txn)
+{
+    int ret = 0;
+    int fd;
+
+    if (!txn)
+        return -EINVAL;
+
+    if (txn->len == 0)
+        goto out;
+
+    fd = property_connect();
+    if (fd < 0) {
+        KVERR("connect failed, fd=%d\n", fd);
+        ret = fd;
+        goto out;
+    }
+
+    /*-----------------------------*
+     | 1 |  2 |  size   | 1 |
+     |-----------------------------|
+     |'B'|size|[records]|'E'|
+     *-----------------------------*/
+
+    uint16_t size = txn->len;
+    char cmd[3] = { 'B' };
+    memcpy(cmd + 1, &size, 2);
+
+    struct iovec iov[3] = {
+        { .iov_base = cmd, .iov_len = 3 },
+        { .iov_base = txn->buf, .iov_len = txn->len },
+        { .iov_base = "E", .iov_len = 1 },
+    };
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    ret = sendmsg(fd, &msg, 0);
+    if (ret < 0) {
+        ret = -errno;
+        KVERR("sendmsg failed, ret=%d\n", ret);
+        goto out_close;
+    }
+
+    /*-----*
+     |  4  |
+     |-----|
+     |error|
+     *-----*/
+
+    int32_t err;
+    ret = recv(fd, &err, 4, 0);
+    if (ret < 4) {
+        KVERR("recv failed, ret=%d\n", ret);
+        ret = ret < 0 ? -errno : -EINVAL;
+        goto out_close;
+    }
+
+    ret = err;
+
+out_close:
+    close(fd);
+out:
+    free(txn);
+    return ret;
+}
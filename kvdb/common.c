@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/param.h>
 
@@ -40,6 +42,32 @@ struct property_list_arg {
     void (*propfn)(const char* key, const char* value, void* cookie);
 };
 
+struct property_image_arg {
+    int fd;
+    int ret;
+};
+
+#ifdef CONFIG_KVDB_CONTEXTS
+struct kvdb_context {
+    char prefix[PROP_NAME_MAX];
+    size_t len;
+    int shard;
+};
+#endif
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+#ifdef CONFIG_KVDB_CONTEXTS
+/* Sorted by the length of the prefix, the first match is the longest */
+
+static struct kvdb_context g_kvdb_context[CONFIG_KVDB_CONTEXTS_MAX];
+static struct kvdb_shard g_kvdb_shard[CONFIG_KVDB_CONTEXTS_MAX];
+static int g_kvdb_contexts = -1; /* until the file is read */
+static int g_kvdb_shards;
+#endif
+
 /****************************************************************************
  * Private Functions
  ****************************************************************************/
@@ -51,6 +79,100 @@ static void property_list_fn(const char* key, const void* value, size_t val_len,
     list->propfn(key, value, list->cookie);
 }
 
+static int property_image_write(int fd, const void* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret < 0)
+            return -errno;
+
+        buf = (const char*)buf + ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+static void property_image_record(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    struct property_image_arg* arg = cookie;
+    size_t key_len = strlen(key) + 1;
+    char cmd[2] = { key_len, val_len };
+
+    if (arg->ret < 0)
+        return;
+
+    arg->ret = property_image_write(arg->fd, cmd, 2);
+    if (arg->ret >= 0)
+        arg->ret = property_image_write(arg->fd, key, key_len);
+    if (arg->ret >= 0)
+        arg->ret = property_image_write(arg->fd, value, val_len);
+}
+
+/* Read the whole image, NULL with errno on failure */
+static char* property_image_read(int fd, size_t* len)
+{
+    size_t max = 5 + CONFIG_KVDB_RESTORE_SIZE + 2;
+    char* buf = malloc(max + 1);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *len = 0;
+    while (*len <= max) {
+        ssize_t ret = read(fd, buf + *len, max + 1 - *len);
+        if (ret < 0) {
+            free(buf);
+            return NULL;
+        } else if (ret == 0)
+            return buf;
+
+        *len += ret;
+    }
+
+    free(buf);
+    errno = E2BIG;
+    return NULL;
+}
+
+/* Turn the image records into transaction sets, the "ro." keys are left
+ * out as they come from the defaults and can't be set again. Every record
+ * grows by the op, out needs len + len / 4 bytes. Returns the length of
+ * the transaction or -EINVAL.
+ */
+static ssize_t property_image_parse(const char* buf, size_t len, char* out)
+{
+    size_t out_len = 0;
+    size_t pos = 5;
+
+    if (len < 7 || memcmp(buf, KVDB_IMAGE_MAGIC, 4) != 0 || buf[4] != KVDB_IMAGE_VERSION)
+        return -EINVAL;
+
+    while (len - pos >= 2) {
+        size_t key_len = (unsigned char)buf[pos];
+        size_t val_len = (unsigned char)buf[pos + 1];
+        const char* key = buf + pos + 2;
+
+        if (key_len == 0)
+            return out_len;
+
+        if (key_len < 2 || val_len == 0 || len - pos < 2 + key_len + val_len
+            || key[key_len - 1] != '\0')
+            return -EINVAL;
+
+        if (strncmp(key, "ro.", 3) != 0) {
+            out[out_len] = 'S';
+            memcpy(out + out_len + 1, buf + pos, 2 + key_len + val_len);
+            out_len += 3 + key_len + val_len;
+        }
+
+        pos += 2 + key_len + val_len;
+    }
+
+    return -EINVAL; /* no end mark, cut off */
+}
+
 static inline char nibble2ascii(unsigned char nibble)
 {
     if (nibble < 10)
@@ -69,6 +191,61 @@ static inline int ascii2nibble(char ascii)
         return -ERANGE;
 }
 
+#ifdef CONFIG_KVDB_CONTEXTS
+/* Parse "prefix shard [sync]", the shards are shared by name */
+static void kvdb_context_add(char* line)
+{
+    char* saveptr;
+    char* end = strchr(line, '#');
+
+    if (end)
+        *end = '\0';
+
+    char* prefix = strtok_r(line, " \t\r\n", &saveptr);
+    char* name = strtok_r(NULL, " \t\r\n", &saveptr);
+    char* policy = strtok_r(NULL, " \t\r\n", &saveptr);
+    if (prefix == NULL)
+        return;
+
+    /* A prefix must not span the persistent and the other keys */
+
+    size_t len = strlen(prefix);
+    int index = len < PERSIST_LABEL_LEN && strncmp(prefix, PERSIST_LABEL, len) == 0
+        ? -EINVAL
+        : kvdb_get_index(prefix);
+
+    if (index < 0 || name == NULL || len >= PROP_NAME_MAX
+        || strlen(name) >= KVDB_SHARD_NAME_MAX || strchr(name, '/')
+        || (policy && strcmp(policy, "sync") != 0)
+        || g_kvdb_contexts == CONFIG_KVDB_CONTEXTS_MAX) {
+        KVERR("bad context %s\n", prefix);
+        return;
+    }
+
+    int shard;
+    for (shard = 0; shard < g_kvdb_shards; shard++) {
+        if (g_kvdb_shard[shard].index == index && strcmp(g_kvdb_shard[shard].name, name) == 0)
+            break;
+    }
+
+    if (shard == g_kvdb_shards) {
+        g_kvdb_shards++;
+        strlcpy(g_kvdb_shard[shard].name, name, KVDB_SHARD_NAME_MAX);
+        g_kvdb_shard[shard].index = index;
+    }
+
+    g_kvdb_shard[shard].sync |= policy != NULL;
+
+    int i = g_kvdb_contexts++;
+    for (; i > 0 && g_kvdb_context[i - 1].len < len; i--)
+        g_kvdb_context[i] = g_kvdb_context[i - 1];
+
+    memcpy(g_kvdb_context[i].prefix, prefix, len + 1);
+    g_kvdb_context[i].len = len;
+    g_kvdb_context[i].shard = KVDB_COUNT + shard;
+}
+#endif
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -86,6 +263,291 @@ int kvdb_get_index(const char* key)
     }
 }
 
+/****************************************************************************
+ * Name: kvdb_locate
+ *
+ * Description:
+ *   Find the store and the database of the key, once for all the calls on
+ *   it.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   struct kvdb_loc* loc: receives the location, a negative index if the
+ *                         key has no store
+ *
+ ****************************************************************************/
+
+void kvdb_locate(const char* key, struct kvdb_loc* loc)
+{
+    loc->index = kvdb_get_index(key);
+    loc->shard = loc->index < 0 ? loc->index : kvdb_get_shard(key, loc->index);
+}
+
+#ifdef CONFIG_KVDB_CONTEXTS
+
+/****************************************************************************
+ * Name: kvdb_shard_init
+ *
+ * Description:
+ *   Read CONFIG_KVDB_CONTEXTS_PATH once, a missing file means no shards.
+ *
+ * Returned Value:
+ *   The number of shards.
+ *
+ ****************************************************************************/
+
+int kvdb_shard_init(void)
+{
+    char line[PROP_NAME_MAX + KVDB_SHARD_NAME_MAX + 16];
+
+    if (g_kvdb_contexts >= 0)
+        return g_kvdb_shards;
+
+    g_kvdb_contexts = 0;
+
+    FILE* f = fopen(CONFIG_KVDB_CONTEXTS_PATH, "r");
+    if (f == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), f))
+        kvdb_context_add(line);
+
+    fclose(f);
+    KVINFO("%d prefixes in %d shards\n", g_kvdb_contexts, g_kvdb_shards);
+    return g_kvdb_shards;
+}
+
+/****************************************************************************
+ * Name: kvdb_get_shard
+ *
+ * Description:
+ *   Find the database of the key, its shard or else its store.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   int index: the store of the key, from kvdb_get_index()
+ *
+ ****************************************************************************/
+
+int kvdb_get_shard(const char* key, int index)
+{
+    for (int i = 0; i < g_kvdb_contexts; i++) {
+        if (strncmp(key, g_kvdb_context[i].prefix, g_kvdb_context[i].len) == 0)
+            return g_kvdb_context[i].shard;
+    }
+
+    return index;
+}
+
+/****************************************************************************
+ * Name: kvdb_shard_get
+ *
+ * Description:
+ *   Describe a database, NULL for the stores and the unused shards.
+ *
+ ****************************************************************************/
+
+const struct kvdb_shard* kvdb_shard_get(int shard)
+{
+    shard -= KVDB_COUNT;
+    return shard >= 0 && shard < g_kvdb_shards ? &g_kvdb_shard[shard] : NULL;
+}
+
+#endif
+
+/****************************************************************************
+ * Name: kvdb_getenv
+ *
+ * Description:
+ *   Look the key up in the environment, which overlays the keys starting
+ *   with CONFIG_KVDB_ENV_PREFIX. Other keys never scan environ.
+ *
+ * Returned Value:
+ *   The value of the environment variable, NULL if the key is not there.
+ *
+ ****************************************************************************/
+
+const char* kvdb_getenv(const char* key)
+{
+#ifdef CONFIG_KVDB_ENV_PREFIX
+    size_t len = sizeof(CONFIG_KVDB_ENV_PREFIX) - 1;
+
+    if (len && strncmp(key, CONFIG_KVDB_ENV_PREFIX, len) == 0)
+        return getenv(key);
+#else
+    (void)key;
+#endif
+
+    return NULL;
+}
+
+/****************************************************************************
+ * Name: kvdb_env_get / kvdb_env_set
+ *
+ * Description:
+ *   The environment overlay of kvdb_getenv() for the binary calls, the
+ *   values are stored with their '\0' like those of property_set().
+ *
+ * Returned Value:
+ *   -ENOENT if the key is not overlaid, the length of the value or 0 on
+ *   success, -errno otherwise.
+ *
+ ****************************************************************************/
+
+ssize_t kvdb_env_get(const char* key, void* value, size_t val_len)
+{
+    const char* env = kvdb_getenv(key);
+    if (env == NULL)
+        return -ENOENT;
+
+    size_t len = strlen(env) + 1;
+    if (len > PROP_VALUE_MAX)
+        return -E2BIG;
+
+    if (value == NULL)
+        return len;
+
+    len = MIN(len, val_len);
+    memcpy(value, env, len);
+    return len;
+}
+
+int kvdb_env_set(const char* key, const void* value, size_t val_len)
+{
+    if (kvdb_getenv(key) == NULL)
+        return -ENOENT;
+
+    if (memchr(value, '\0', val_len) == NULL)
+        return -EINVAL;
+
+    return setenv(key, value, 1) < 0 ? -errno : 0;
+}
+
+/****************************************************************************
+ * Name: kvdb_uptime_ms
+ *
+ * Description:
+ *   The monotonic time in ms, which the client deadlines are counted in.
+ *
+ ****************************************************************************/
+
+int64_t kvdb_uptime_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/****************************************************************************
+ * Name: kvdb_deadline
+ *
+ * Description:
+ *   Encode a deadline of kvdb_uptime_ms() for KVDB_FLAG_DEADLINE. The
+ *   server on another core only gets the time left, it starts counting
+ *   when it reads the request.
+ *
+ ****************************************************************************/
+
+uint32_t kvdb_deadline(int64_t deadline)
+{
+#ifdef CONFIG_KVDB_SERVER
+    return deadline;
+#else
+    return MAX(deadline - kvdb_uptime_ms(), 0);
+#endif
+}
+
+/****************************************************************************
+ * Name: kvdb_atomic_eval
+ *
+ * Description:
+ *   Work out the outcome of an atomic operation against the current value.
+ *   Shared by the server and the direct mode so both agree on semantics.
+ *
+ * Input Parameters:
+ *   int type: one of PROPERTY_ATOMIC_*
+ *   const void* cur: the current value
+ *   ssize_t cur_len: the length of the current value, <0 if absent
+ *   uint32_t serial: the current serial of the key
+ *   const void* arg, size_t arg_len: the operation argument
+ *   const void* value, size_t val_len: the value to store
+ *   void* newval: buffer of PROP_VALUE_MAX to receive the value to store
+ *   size_t* new_len: receive the length of newval
+ *
+ * Returned Value:
+ *         1: newval should be stored
+ *         0: nothing to store
+ *        <0: the operation fails with this error
+ *
+ ****************************************************************************/
+
+int kvdb_atomic_eval(int type, const void* cur, ssize_t cur_len, uint32_t serial,
+    const void* arg, size_t arg_len, const void* value, size_t val_len,
+    void* newval, size_t* new_len)
+{
+    switch (type) {
+    case PROPERTY_ATOMIC_GET:
+        return cur_len < 0 ? -ENOENT : 0;
+    case PROPERTY_ATOMIC_CAS:
+        if (cur_len != (ssize_t)arg_len || memcmp(cur, arg, arg_len) != 0)
+            return -EAGAIN;
+        break;
+    case PROPERTY_ATOMIC_CAS_SERIAL: {
+        uint32_t expected;
+        if (arg_len != sizeof(expected))
+            return -EINVAL;
+
+        memcpy(&expected, arg, sizeof(expected));
+        if (expected != serial)
+            return -EAGAIN;
+        break;
+    }
+    case PROPERTY_ATOMIC_SET_IF_ABSENT:
+        if (cur_len >= 0)
+            return -EEXIST;
+        break;
+    case PROPERTY_ATOMIC_ADD: {
+        char buf[PROP_VALUE_MAX];
+        int64_t delta;
+        int64_t num = 0;
+
+        if (arg_len != sizeof(delta))
+            return -EINVAL;
+
+        memcpy(&delta, arg, sizeof(delta));
+        if (cur_len > 0) {
+            char* end;
+
+            /* the stored value may miss the terminating zero */
+
+            memcpy(buf, cur, MIN(cur_len, PROP_VALUE_MAX - 1));
+            buf[MIN(cur_len, PROP_VALUE_MAX - 1)] = '\0';
+
+            errno = 0;
+            num = strtoll(buf, &end, 0);
+            if (errno || *end || buf == end)
+                return -EINVAL;
+        }
+
+        if ((delta > 0 && num > INT64_MAX - delta) || (delta < 0 && num < INT64_MIN - delta))
+            return -ERANGE;
+
+        *new_len = snprintf(newval, PROP_VALUE_MAX, "%" PRId64, num + delta) + 1;
+        return 1;
+    }
+    default:
+        return -EINVAL;
+    }
+
+    if (val_len == 0 || val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    memcpy(newval, value, val_len);
+    *new_len = val_len;
+    return 1;
+}
+
 /****************************************************************************
  * Name: property_set_
  *
@@ -108,7 +570,7 @@ static int property_set_(const char* key, const char* value, bool oneway)
         value = "";
 
     /* in environment variable? */
-    if (getenv(key)) {
+    if (kvdb_getenv(key)) {
         int ret = setenv(key, value, 1);
         if (ret < 0)
             ret = -errno;
@@ -162,7 +624,7 @@ int property_set(const char* key, const char* value)
 int property_get(const char* key, char* value, const char* default_value)
 {
     /* in environment variable? */
-    const char* env = getenv(key);
+    const char* env = kvdb_getenv(key);
     if (env) {
         size_t len = strlen(env);
         if (len >= PROP_VALUE_MAX)
@@ -513,3 +975,322 @@ ssize_t property_get_buffer(const char* key, void* value, size_t size)
 
     return i / 2;
 }
+
+/****************************************************************************
+ * Name: property_get_serial
+ *
+ * Description:
+ *   Retrieve a Key-Value together with the serial of the key.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   void* value: buffer to receive the value, may be NULL
+ *   size_t val_len: the size of value
+ *   uint32_t* serial: receive the serial
+ *
+ * Returned Value:
+ *   On success returns the length of the value.
+ *   On failure returns -errno.
+ *
+ ****************************************************************************/
+
+ssize_t property_get_serial(const char* key, void* value, size_t val_len, uint32_t* serial)
+{
+    return property_atomic_binary(PROPERTY_ATOMIC_GET, key, NULL, 0, NULL, 0,
+        value, val_len, serial);
+}
+
+/****************************************************************************
+ * Name: property_compare_and_set
+ *
+ * Description:
+ *   Store value only if the current value equals expected.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   const char* expected: the expected value string
+ *   const char* value: entry value string
+ *
+ * Returned Value:
+ *         0: success
+ *   -EAGAIN: the current value differs from expected
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_compare_and_set(const char* key, const char* expected, const char* value)
+{
+    if (!expected || !value)
+        return -EINVAL;
+
+    ssize_t ret = property_atomic_binary(PROPERTY_ATOMIC_CAS, key, expected,
+        strlen(expected) + 1, value, strlen(value) + 1, NULL, 0, NULL);
+    return ret < 0 ? ret : 0;
+}
+
+/****************************************************************************
+ * Name: property_compare_and_set_serial
+ *
+ * Description:
+ *   Store value only if the key was not changed since serial was read.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   uint32_t serial: the serial returned by property_get_serial()
+ *   const char* value: entry value string
+ *
+ * Returned Value:
+ *         0: success
+ *   -EAGAIN: the key was changed in between
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_compare_and_set_serial(const char* key, uint32_t serial, const char* value)
+{
+    if (!value)
+        return -EINVAL;
+
+    ssize_t ret = property_atomic_binary(PROPERTY_ATOMIC_CAS_SERIAL, key, &serial,
+        sizeof(serial), value, strlen(value) + 1, NULL, 0, NULL);
+    return ret < 0 ? ret : 0;
+}
+
+/****************************************************************************
+ * Name: property_set_if_absent
+ *
+ * Description:
+ *   Store value only if the key does not exist yet.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string
+ *   const char* value: entry value string
+ *
+ * Returned Value:
+ *         0: success
+ *   -EEXIST: the key already exists
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_set_if_absent(const char* key, const char* value)
+{
+    if (!value)
+        return -EINVAL;
+
+    ssize_t ret = property_atomic_binary(PROPERTY_ATOMIC_SET_IF_ABSENT, key, NULL, 0,
+        value, strlen(value) + 1, NULL, 0, NULL);
+    return ret < 0 ? ret : 0;
+}
+
+/****************************************************************************
+ * Name: property_add_and_fetch_int64
+ *
+ * Description:
+ *   Add delta to a 64-bit integer property and return the new value.
+ *
+ * Input Parameters:
+ *   const char* key: entry key string, a missing key counts as 0
+ *   int64_t delta: the value to add
+ *   int64_t* result: receive the new value, may be NULL
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_add_and_fetch_int64(const char* key, int64_t delta, int64_t* result)
+{
+    char buf[32];
+
+    ssize_t ret = property_atomic_binary(PROPERTY_ATOMIC_ADD, key, &delta,
+        sizeof(delta), NULL, 0, buf, sizeof(buf) - 1, NULL);
+    if (ret < 0)
+        return ret;
+
+    buf[ret] = '\0';
+    if (result)
+        *result = strtoll(buf, NULL, 0);
+
+    return 0;
+}
+
+/****************************************************************************
+ * Name: property_snapshot
+ *
+ * Description:
+ *   Write an image of all the stores to fd. The server takes it in a single
+ *   step, so the image is a consistent point in time.
+ *
+ * Input Parameters:
+ *   int fd: the file or socket to write to
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_snapshot(int fd)
+{
+    struct property_image_arg arg = { .fd = fd };
+    char header[5] = KVDB_IMAGE_MAGIC;
+
+    header[4] = KVDB_IMAGE_VERSION;
+    arg.ret = property_image_write(fd, header, 5);
+    if (arg.ret < 0)
+        return arg.ret;
+
+    int ret = property_image_list(property_image_record, &arg);
+    if (ret < 0)
+        return ret;
+    else if (arg.ret < 0)
+        return arg.ret;
+
+    return property_image_write(fd, "\0", 2);
+}
+
+/****************************************************************************
+ * Name: property_restore
+ *
+ * Description:
+ *   Load an image written by property_snapshot() in a single transaction,
+ *   keys missing from the image are kept and "ro." keys are skipped.
+ *
+ * Input Parameters:
+ *   int fd: the file or socket to read from
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_restore(int fd)
+{
+    size_t len;
+    char* buf = property_image_read(fd, &len);
+    if (buf == NULL)
+        return -errno;
+
+    ssize_t ret = -ENOMEM;
+    char* txn = malloc(len + len / 4);
+    if (txn) {
+        ret = property_image_parse(buf, len, txn);
+        if (ret > 0)
+            ret = property_image_apply(txn, ret);
+        free(txn);
+    }
+
+    free(buf);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: property_txn_begin
+ *
+ * Description:
+ *   Start a transaction, the operations are buffered until commit.
+ *
+ * Returned Value:
+ *   On success returns the transaction handle, NULL otherwise.
+ *
+ ****************************************************************************/
+
+struct property_txn* property_txn_begin(void)
+{
+    struct property_txn* txn = malloc(sizeof(struct property_txn));
+    if (txn)
+        txn->len = 0;
+
+    return txn;
+}
+
+/****************************************************************************
+ * Name: property_txn_set_binary
+ *
+ * Description:
+ *   Add a set operation to the transaction.
+ *
+ * Input Parameters:
+ *   struct property_txn* txn: handle returned by property_txn_begin()
+ *   const char* key: entry key string
+ *   const void* value: entry value
+ *   size_t val_len: the length of the value, 0 means delete
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_txn_set_binary(struct property_txn* txn, const char* key, const void* value, size_t val_len)
+{
+    if (!txn || !key)
+        return -EINVAL;
+
+    size_t key_len = strlen(key) + 1;
+    if (key_len > PROP_NAME_MAX || val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    size_t total = 3 + key_len + val_len;
+    if (txn->len + total > sizeof(txn->buf))
+        return -E2BIG;
+
+    char* rec = txn->buf + txn->len;
+    rec[0] = val_len ? 'S' : 'D';
+    rec[1] = key_len;
+    rec[2] = val_len;
+    memcpy(rec + 3, key, key_len);
+    if (val_len)
+        memcpy(rec + 3 + key_len, value, val_len);
+
+    txn->len += total;
+    return 0;
+}
+
+int property_txn_set(struct property_txn* txn, const char* key, const char* value)
+{
+    if (!value)
+        value = "";
+
+    return property_txn_set_binary(txn, key, value, strlen(value) + 1);
+}
+
+/****************************************************************************
+ * Name: property_txn_delete
+ *
+ * Description:
+ *   Add a delete operation to the transaction.
+ *
+ * Input Parameters:
+ *   struct property_txn* txn: handle returned by property_txn_begin()
+ *   const char* key: entry key string
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_txn_delete(struct property_txn* txn, const char* key)
+{
+    return property_txn_set_binary(txn, key, NULL, 0);
+}
+
+/****************************************************************************
+ * Name: property_txn_abort
+ *
+ * Description:
+ *   Drop all operations of the transaction and release it.
+ *
+ * Input Parameters:
+ *   struct property_txn* txn: handle returned by property_txn_begin()
+ *
+ ****************************************************************************/
+
+void property_txn_abort(struct property_txn* txn)
+{
+    free(txn);
+}
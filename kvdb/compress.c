@@ -0,0 +1,664 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/param.h>
+
+#include <kvdb.h>
+
+#include "internal.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#ifndef CONFIG_KVDB_COMPRESS_DICT_SIZE
+#define CONFIG_KVDB_COMPRESS_DICT_SIZE 128
+#endif
+
+#ifndef CONFIG_KVDB_COMPRESS_TRAIN
+#define CONFIG_KVDB_COMPRESS_TRAIN 32
+#endif
+
+/* A persist value is stored as is, unless its first byte is a mark:
+ *-----------------------------*
+ |      1       |     ...      |
+ |-----------------------------|
+ |KVDB_PACK_RAW |  the value   |
+ |KVDB_PACK_LZ  |    tokens    |
+ |KVDB_PACK_DICT|    tokens    |
+ *-----------------------------*
+ * RAW escapes a value starting with a mark, LZ is compressed on its own
+ * and DICT with the dictionary, which sits right before the value so the
+ * matches can reach into it. The tokens are literal runs, t < 0x80
+ * followed by t + 1 bytes, and matches, t >= 0x80 for (t & 0x7f) + 3
+ * bytes found back at the distance d + 1, d in one byte if < 0x80 or else
+ * ((b0 & 0x7f) << 8 | b1).
+ */
+
+#define KVDB_PACK_RAW 0x1c
+#define KVDB_PACK_LZ 0x1d
+#define KVDB_PACK_DICT 0x1e
+
+#define KVDB_MATCH_MIN 3
+#define KVDB_MATCH_MAX (0x7f + KVDB_MATCH_MIN)
+#define KVDB_LITERAL_MAX 0x80
+
+/* The fragments counted while training, most values are short paths,
+ * numbers and words separated by punctuation.
+ */
+
+#define KVDB_TRAIN_SLOTS 64
+#define KVDB_TRAIN_FRAG 32
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+struct kvdb_dict {
+    bool loaded;
+    bool saving; /* lets the hidden keys through kvdb_pack() */
+    bool raw; /* lists the values as stored */
+    size_t len;
+    uint8_t buf[CONFIG_KVDB_COMPRESS_DICT_SIZE];
+};
+
+typedef struct kvdb_frag {
+    uint8_t len;
+    uint32_t count;
+    char buf[KVDB_TRAIN_FRAG];
+} kvdb_frag;
+
+typedef struct kvdb_train {
+    size_t values;
+    kvdb_frag frag[KVDB_TRAIN_SLOTS];
+} kvdb_train;
+
+/* The stored values to escape, key_len, val_len, key and value each */
+
+typedef struct kvdb_escape {
+    char* buf;
+    size_t len;
+    size_t size;
+    int ret;
+} kvdb_escape;
+
+/****************************************************************************
+ * Private Data
+ ****************************************************************************/
+
+/* One per process, the server and the direct mode both load it once */
+
+static struct kvdb_dict g_kvdb_dict;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/* The byte at pos of the dictionary followed by the value */
+static inline uint8_t kvdb_window(const uint8_t* dict, size_t dict_len,
+    const uint8_t* in, size_t pos)
+{
+    return pos < dict_len ? dict[pos] : in[pos - dict_len];
+}
+
+static size_t kvdb_match_cost(size_t dist)
+{
+    return dist <= 0x80 ? 2 : 3;
+}
+
+static ssize_t kvdb_lz_encode(const uint8_t* dict, size_t dict_len,
+    const uint8_t* in, size_t len, uint8_t* out, size_t size)
+{
+    size_t lit = 0; /* start of the pending literals */
+    size_t pos = 0;
+    size_t n = 0;
+
+    while (pos < len) {
+        size_t cur = dict_len + pos;
+        size_t limit = MIN(len - pos, KVDB_MATCH_MAX);
+        size_t best = 0;
+        size_t dist = 0;
+
+        /* Greedy and brute force, the window is a few hundred bytes */
+
+        for (size_t from = 0; from < cur && best < limit; from++) {
+            size_t l = 0;
+
+            while (l < limit && kvdb_window(dict, dict_len, in, from + l) == in[pos + l])
+                l++;
+
+            if (l > best || (l == best && cur - from < dist)) {
+                best = l;
+                dist = cur - from;
+            }
+        }
+
+        bool match = best >= KVDB_MATCH_MIN && best > kvdb_match_cost(dist);
+
+        if (!match) {
+            pos++;
+            if (pos - lit < KVDB_LITERAL_MAX && pos < len)
+                continue;
+        }
+
+        if (pos > lit) {
+            size_t run = pos - lit;
+
+            if (n + 1 + run > size)
+                return -E2BIG;
+
+            out[n++] = run - 1;
+            memcpy(out + n, in + lit, run);
+            n += run;
+            lit = pos;
+        }
+
+        if (match) {
+            if (n + kvdb_match_cost(dist) > size)
+                return -E2BIG;
+
+            out[n++] = 0x80 | (best - KVDB_MATCH_MIN);
+            if (--dist < 0x80) {
+                out[n++] = dist;
+            } else {
+                out[n++] = 0x80 | (dist >> 8);
+                out[n++] = dist & 0xff;
+            }
+
+            pos += best;
+            lit = pos;
+        }
+    }
+
+    return n;
+}
+
+static ssize_t kvdb_lz_decode(const uint8_t* dict, size_t dict_len,
+    const uint8_t* in, size_t len, uint8_t* out, size_t size)
+{
+    size_t pos = 0;
+    size_t n = 0;
+
+    while (pos < len) {
+        uint8_t t = in[pos++];
+
+        if (t < 0x80) {
+            size_t run = t + 1;
+
+            if (run > len - pos || run > size - n)
+                return -EINVAL;
+
+            memcpy(out + n, in + pos, run);
+            pos += run;
+            n += run;
+            continue;
+        }
+
+        size_t l = (t & 0x7f) + KVDB_MATCH_MIN;
+        size_t dist;
+
+        if (pos == len)
+            return -EINVAL;
+
+        dist = in[pos++];
+        if (dist & 0x80) {
+            if (pos == len)
+                return -EINVAL;
+
+            dist = (dist & 0x7f) << 8 | in[pos++];
+        }
+
+        dist++;
+        if (dist > dict_len + n || l > size - n)
+            return -EINVAL;
+
+        /* Byte by byte, a match may overlap what it produces */
+
+        for (size_t from = dict_len + n - dist; l-- > 0; from++)
+            out[n++] = kvdb_window(dict, dict_len, out, from);
+    }
+
+    return n;
+}
+
+static bool kvdb_is_dict(const char* key)
+{
+    return strcmp(key, KVDB_DICT_KEY) == 0;
+}
+
+static bool kvdb_is_hidden(const char* key)
+{
+    return kvdb_is_dict(key) || strcmp(key, KVDB_FORMAT_KEY) == 0;
+}
+
+/* Count a fragment, the least counted one makes room once the table is
+ * full and its count is carried over, as in the space saving algorithm.
+ */
+
+static void kvdb_train_frag(kvdb_train* train, const char* frag, size_t len)
+{
+    kvdb_frag* min = &train->frag[0];
+
+    if (len < KVDB_MATCH_MIN + 1 || len > KVDB_TRAIN_FRAG)
+        return;
+
+    for (int i = 0; i < KVDB_TRAIN_SLOTS; i++) {
+        kvdb_frag* f = &train->frag[i];
+
+        if (f->len == len && memcmp(f->buf, frag, len) == 0) {
+            f->count++;
+            return;
+        }
+
+        if (f->count < min->count)
+            min = f;
+    }
+
+    min->count++;
+    min->len = len;
+    memcpy(min->buf, frag, len);
+}
+
+static void kvdb_train_consume(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    kvdb_train* train = cookie;
+    const char* v = value;
+    size_t start = 0;
+    size_t frags = 0;
+
+    if (kvdb_get_index(key) != KVDB_PERSIST || kvdb_is_hidden(key))
+        return;
+
+    train->values++;
+
+    /* Fragments end with a separator, which makes "/data/" or "true\0",
+     * the whole value counts too if it has more than one.
+     */
+
+    for (size_t i = 0; i < val_len; i++) {
+        if (strchr("/.,:;=_- ", v[i]) || v[i] == '\0') {
+            kvdb_train_frag(train, v + start, i + 1 - start);
+            start = i + 1;
+            frags++;
+        }
+    }
+
+    if (start < val_len) {
+        kvdb_train_frag(train, v + start, val_len - start);
+        frags++;
+    }
+
+    if (frags > 1)
+        kvdb_train_frag(train, v, val_len);
+}
+
+static long kvdb_frag_score(const kvdb_frag* f)
+{
+    return f->count > 1 ? (long)(f->count - 1) * f->len : 0;
+}
+
+static int kvdb_frag_compare(const void* a, const void* b)
+{
+    long x = kvdb_frag_score(a);
+    long y = kvdb_frag_score(b);
+
+    return x < y ? -1 : x > y;
+}
+
+/* Pick the fragments saving the most, the best ones go last as they are
+ * closest to the value and cheapest to reach.
+ */
+
+static size_t kvdb_train_build(kvdb_train* train, uint8_t* dict, size_t size)
+{
+    bool take[KVDB_TRAIN_SLOTS] = { false };
+    size_t len = 0;
+    int i;
+
+    qsort(train->frag, KVDB_TRAIN_SLOTS, sizeof(kvdb_frag), kvdb_frag_compare);
+
+    for (i = KVDB_TRAIN_SLOTS - 1; i >= 0; i--) {
+        kvdb_frag* f = &train->frag[i];
+
+        if (kvdb_frag_score(f) == 0 || len + f->len > size)
+            continue;
+
+        take[i] = true;
+        len += f->len;
+    }
+
+    len = 0;
+    for (i = 0; i < KVDB_TRAIN_SLOTS; i++) {
+        if (take[i]) {
+            memcpy(dict + len, train->frag[i].buf, train->frag[i].len);
+            len += train->frag[i].len;
+        }
+    }
+
+    return len;
+}
+
+static int kvdb_dict_train(struct kvdb* kvdb)
+{
+    uint8_t dict[CONFIG_KVDB_COMPRESS_DICT_SIZE];
+
+    kvdb_train* train = calloc(1, sizeof(kvdb_train));
+    if (train == NULL)
+        return -ENOMEM;
+
+    int ret = kvdb_list(kvdb, kvdb_train_consume, train);
+    size_t len = 0;
+
+    if (ret >= 0 && train->values >= CONFIG_KVDB_COMPRESS_TRAIN)
+        len = kvdb_train_build(train, dict, sizeof(dict));
+
+    free(train);
+    if (ret < 0 || len == 0)
+        return ret;
+
+    /* Never replaced once saved, the values packed with it need it */
+
+    g_kvdb_dict.saving = true;
+    ret = kvdb_set(kvdb, KVDB_DICT_KEY, sizeof(KVDB_DICT_KEY), dict, len, true);
+    g_kvdb_dict.saving = false;
+    if (ret >= 0)
+        ret = kvdb_commit(kvdb);
+    if (ret < 0)
+        return ret;
+
+    memcpy(g_kvdb_dict.buf, dict, len);
+    g_kvdb_dict.len = len;
+    KVINFO("trained a dictionary of %zu bytes\n", len);
+    return 0;
+}
+
+static void kvdb_escape_consume(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    kvdb_escape* escape = cookie;
+    const uint8_t* v = value;
+    size_t key_len = strlen(key) + 1;
+    size_t len = 2 + key_len + val_len;
+
+    if (kvdb_get_index(key) != KVDB_PERSIST || kvdb_is_hidden(key)
+        || val_len == 0 || v[0] < KVDB_PACK_RAW || v[0] > KVDB_PACK_DICT)
+        return;
+
+    if (escape->len + len > escape->size) {
+        size_t size = MAX(escape->size * 2, escape->len + len);
+        char* buf = realloc(escape->buf, size);
+        if (buf == NULL) {
+            escape->ret = -ENOMEM;
+            return;
+        }
+
+        escape->buf = buf;
+        escape->size = size;
+    }
+
+    escape->buf[escape->len] = key_len;
+    escape->buf[escape->len + 1] = val_len;
+    memcpy(escape->buf + escape->len + 2, key, key_len);
+    memcpy(escape->buf + escape->len + 2 + key_len, value, val_len);
+    escape->len += len;
+}
+
+/* A store gets the packed format once. The values stored before are read
+ * as they are, but the ones starting with a mark would be taken for packed
+ * values, they are stored again escaped. A store which has a dictionary
+ * was packed already. The format key records it is done, its value is the
+ * version of the format.
+ */
+
+static int kvdb_format_init(struct kvdb* kvdb, bool packed)
+{
+    kvdb_escape escape = { 0 };
+    char version;
+    int ret = 0;
+
+    if (kvdb_get(kvdb, KVDB_FORMAT_KEY, sizeof(KVDB_FORMAT_KEY), &version, 1) > 0)
+        return 0;
+
+    if (!packed) {
+        g_kvdb_dict.raw = true;
+        ret = kvdb_list(kvdb, kvdb_escape_consume, &escape);
+        g_kvdb_dict.raw = false;
+        if (ret >= 0)
+            ret = escape.ret;
+
+        for (size_t pos = 0; ret >= 0 && pos < escape.len;) {
+            size_t key_len = (unsigned char)escape.buf[pos];
+            size_t val_len = (unsigned char)escape.buf[pos + 1];
+            const char* key = escape.buf + pos + 2;
+
+            ret = kvdb_set(kvdb, key, key_len, key + key_len, val_len, true);
+            pos += 2 + key_len + val_len;
+        }
+
+        free(escape.buf);
+    }
+
+    if (ret >= 0) {
+        g_kvdb_dict.saving = true;
+        ret = kvdb_set(kvdb, KVDB_FORMAT_KEY, sizeof(KVDB_FORMAT_KEY), "1", 1, true);
+        g_kvdb_dict.saving = false;
+    }
+
+    if (ret >= 0)
+        ret = kvdb_commit(kvdb);
+    if (ret >= 0 && escape.len > 0)
+        KVINFO("escaped the stored values for the packed format\n");
+
+    return ret;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: kvdb_dict_init
+ *
+ * Description:
+ *   Load the compression dictionary, or train one from the persist values
+ *   the first time there are CONFIG_KVDB_COMPRESS_TRAIN of them. Values
+ *   are compressed on their own until then. The first time compression is
+ *   enabled, the stored values are made readable in the packed format.
+ *   Called by the backends once their stores are open, runs once per
+ *   process. A failure to train is not fatal, the values are compressed on
+ *   their own then.
+ *
+ * Input Parameters:
+ *   kvdb - Pointer to the database instance.
+ *
+ ****************************************************************************/
+
+void kvdb_dict_init(struct kvdb* kvdb)
+{
+    uint8_t dict[PROP_VALUE_MAX];
+
+    if (g_kvdb_dict.loaded)
+        return;
+
+    g_kvdb_dict.loaded = true;
+
+    /* The backends differ in how they report a missing key */
+
+    ssize_t ret = kvdb_get(kvdb, KVDB_DICT_KEY, sizeof(KVDB_DICT_KEY), dict, sizeof(dict));
+    int err = kvdb_format_init(kvdb, ret > 0);
+    if (err < 0)
+        KVERR("packed format init failed %d\n", err);
+
+    if (ret <= 0) {
+        ret = kvdb_dict_train(kvdb);
+        if (ret < 0)
+            KVERR("dictionary training failed %zd\n", ret);
+        return;
+    }
+
+    g_kvdb_dict.len = MIN((size_t)ret, sizeof(g_kvdb_dict.buf));
+    memcpy(g_kvdb_dict.buf, dict, g_kvdb_dict.len);
+}
+
+/****************************************************************************
+ * Name: kvdb_dict_protect
+ *
+ * Description:
+ *   Refuse to set or delete the keys holding the dictionary and the mark
+ *   of the packed format.
+ *
+ * Returned Value:
+ *   0 if the key may be changed, -EPERM otherwise.
+ *
+ ****************************************************************************/
+
+int kvdb_dict_protect(const char* key)
+{
+    return kvdb_is_hidden(key) && !g_kvdb_dict.saving ? -EPERM : 0;
+}
+
+/****************************************************************************
+ * Name: kvdb_pack
+ *
+ * Description:
+ *   Compress a persist value before it is stored. It is kept as is when
+ *   that does not save anything.
+ *
+ * Input Parameters:
+ *   key     - The key, the dictionary can't be set.
+ *   value   - The value.
+ *   val_len - The length of the value, < PROP_VALUE_MAX.
+ *   buf     - Gets the stored form, KVDB_PACK_MAX bytes.
+ *
+ * Returned Value:
+ *   The length of the stored form, -ERRNO errno code if error.
+ *
+ ****************************************************************************/
+
+ssize_t kvdb_pack(const char* key, const void* value, size_t val_len, void* buf)
+{
+    const uint8_t* in = value;
+    uint8_t* out = buf;
+
+    int ret = kvdb_dict_protect(key);
+    if (ret < 0)
+        return ret;
+
+    if (val_len > KVDB_MATCH_MIN && !kvdb_is_dict(key)) {
+        ssize_t len = kvdb_lz_encode(g_kvdb_dict.buf, g_kvdb_dict.len,
+            in, val_len, out + 1, val_len - 2);
+        if (len > 0) {
+            out[0] = g_kvdb_dict.len ? KVDB_PACK_DICT : KVDB_PACK_LZ;
+            return len + 1;
+        }
+    }
+
+    if (val_len && in[0] >= KVDB_PACK_RAW && in[0] <= KVDB_PACK_DICT) {
+        out[0] = KVDB_PACK_RAW;
+        memcpy(out + 1, in, val_len);
+        return val_len + 1;
+    }
+
+    memcpy(out, in, val_len);
+    return val_len;
+}
+
+/****************************************************************************
+ * Name: kvdb_unpack
+ *
+ * Description:
+ *   Turn the stored form of a persist value back into the value.
+ *
+ * Input Parameters:
+ *   buf     - The stored form.
+ *   len     - Its length.
+ *   value   - Gets the value.
+ *   val_len - The size of value, a longer value is cut off.
+ *
+ * Returned Value:
+ *   The length of value, -ERRNO errno code if error.
+ *
+ ****************************************************************************/
+
+ssize_t kvdb_unpack(const void* buf, size_t len, void* value, size_t val_len)
+{
+    const uint8_t* in = buf;
+    uint8_t out[PROP_VALUE_MAX];
+    ssize_t ret;
+
+    if (len == 0 || in[0] < KVDB_PACK_RAW || in[0] > KVDB_PACK_DICT) {
+        ret = MIN(len, val_len);
+        memmove(value, in, ret);
+        return ret;
+    } else if (in[0] == KVDB_PACK_RAW) {
+        ret = MIN(len - 1, val_len);
+        memmove(value, in + 1, ret);
+        return ret;
+    } else if (in[0] == KVDB_PACK_DICT && g_kvdb_dict.len == 0) {
+        KVERR("packed value without a dictionary\n");
+        return -EIO;
+    }
+
+    if (in[0] == KVDB_PACK_DICT)
+        ret = kvdb_lz_decode(g_kvdb_dict.buf, g_kvdb_dict.len, in + 1, len - 1, out, sizeof(out));
+    else
+        ret = kvdb_lz_decode(NULL, 0, in + 1, len - 1, out, sizeof(out));
+
+    if (ret < 0)
+        return ret;
+
+    ret = MIN((size_t)ret, val_len);
+    memcpy(value, out, ret);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: kvdb_unpack_consume
+ *
+ * Description:
+ *   Pass a listed value to consume as kvdb_get() would return it, the
+ *   hidden keys are not listed.
+ *
+ ****************************************************************************/
+
+void kvdb_unpack_consume(kvdb_consume consume, const char* key,
+    const void* value, size_t val_len, void* cookie)
+{
+    char buf[PROP_VALUE_MAX];
+
+    if (kvdb_get_index(key) != KVDB_PERSIST || g_kvdb_dict.raw) {
+        consume(key, value, val_len, cookie);
+        return;
+    }
+
+    if (kvdb_is_hidden(key))
+        return;
+
+    ssize_t ret = kvdb_unpack(value, val_len, buf, sizeof(buf));
+    if (ret < 0) {
+        KVERR("unpack %s failed %zd\n", key, ret);
+        return;
+    }
+
+    consume(key, buf, ret, cookie);
+}
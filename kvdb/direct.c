@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/param.h>
+
 #include <kvdb.h>
 
 #include "internal.h"
@@ -70,6 +72,23 @@ int property_set_binary(const char* key, const void* value, size_t val_len, bool
     return ret;
 }
 
+/****************************************************************************
+ * Name: property_set_ttl
+ *
+ * Description:
+ *   Keys expire in kvdbd only, nothing here would delete them.
+ *
+ ****************************************************************************/
+
+int property_set_ttl(const char* key, const void* value, size_t val_len, uint32_t ttl)
+{
+    UNUSED(key);
+    UNUSED(value);
+    UNUSED(val_len);
+    UNUSED(ttl);
+    return -ENOTSUP;
+}
+
 /****************************************************************************
  * Name: property_get_binary
  *
@@ -106,6 +125,43 @@ ssize_t property_get_binary(const char* key, void* value, size_t val_len)
     return len;
 }
 
+/****************************************************************************
+ * Name: property_set_binary_timeout / property_get_binary_timeout
+ *
+ * Description:
+ *   There is no server to wait for, the backend is reached in place. The
+ *   environment overlays the keys as for property_set() and property_get().
+ *
+ ****************************************************************************/
+
+int property_set_binary_timeout(const char* key, const void* value, size_t val_len, int timeout)
+{
+    UNUSED(timeout);
+
+    if (!key || !value)
+        return -EINVAL;
+
+    int ret = kvdb_env_set(key, value, val_len);
+    if (ret != -ENOENT)
+        return ret;
+
+    return property_set_binary(key, value, val_len, false);
+}
+
+ssize_t property_get_binary_timeout(const char* key, void* value, size_t val_len, int timeout)
+{
+    UNUSED(timeout);
+
+    if (!key)
+        return -EINVAL;
+
+    ssize_t ret = kvdb_env_get(key, value, val_len);
+    if (ret != -ENOENT)
+        return ret;
+
+    return property_get_binary(key, value, val_len);
+}
+
 /****************************************************************************
  * Name: property_delete
  *
@@ -131,7 +187,7 @@ int property_delete(const char* key)
         return -E2BIG;
 
     /* in environment variable? */
-    if (getenv(key)) {
+    if (kvdb_getenv(key)) {
         int ret = unsetenv(key);
         if (ret < 0)
             ret = -errno;
@@ -175,6 +231,175 @@ int property_list_binary(void (*propfn)(const char* key, const void* value, size
     return ret;
 }
 
+/****************************************************************************
+ * Name: property_stats
+ *
+ * Description:
+ *   Statistics are kept by kvdbd only.
+ *
+ ****************************************************************************/
+
+int property_stats(void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
+{
+    UNUSED(propfn);
+    UNUSED(cookie);
+    return -ENOTSUP;
+}
+
+/****************************************************************************
+ * Name: property_trace
+ *
+ * Description:
+ *   Requests are traced by kvdbd only.
+ *
+ ****************************************************************************/
+
+int property_trace(int raw, void (*propfn)(const char* key, const void* value, size_t val_len, void* cookie), void* cookie)
+{
+    UNUSED(raw);
+    UNUSED(propfn);
+    UNUSED(cookie);
+    return -ENOTSUP;
+}
+
+/****************************************************************************
+ * Name: property_atomic_binary
+ *
+ * Description:
+ *   Perform a read-modify-write on the database. Without a server there is
+ *   no one to arbitrate between tasks, so this is only as atomic as the
+ *   backend itself and keys carry no serial.
+ *
+ * Input Parameters:
+ *   int type: one of PROPERTY_ATOMIC_*
+ *   const char* key: entry key string
+ *   const void* arg, size_t arg_len: the operation argument
+ *   const void* value, size_t val_len: the value to store
+ *   void* out, size_t out_len: buffer to receive the resulting value
+ *   uint32_t* serial: receive the serial of the key, always 0
+ *
+ * Returned Value:
+ *   On success returns the length of the value copied to out.
+ *   On failure returns -errno.
+ *
+ ****************************************************************************/
+
+ssize_t property_atomic_binary(int type, const char* key, const void* arg, size_t arg_len,
+    const void* value, size_t val_len, void* out, size_t out_len, uint32_t* serial)
+{
+    char cur[PROP_VALUE_MAX];
+    char newval[PROP_VALUE_MAX];
+    size_t new_len;
+
+    if (!key)
+        return -EINVAL;
+
+    size_t key_len = strlen(key) + 1;
+    if (key_len > PROP_NAME_MAX)
+        return -E2BIG;
+
+    if (type == PROPERTY_ATOMIC_CAS_SERIAL)
+        return -ENOTSUP;
+
+    struct kvdb* client;
+    int ret = kvdb_init(&client);
+    if (ret < 0)
+        return ret;
+
+    ssize_t cur_len = kvdb_get(client, key, key_len, cur, sizeof(cur));
+    ret = kvdb_atomic_eval(type, cur, cur_len, 0, arg, arg_len, value, val_len,
+        newval, &new_len);
+    if (ret > 0) {
+        ret = kvdb_set(client, key, key_len, newval, new_len, false);
+        if (ret >= 0) {
+            memcpy(cur, newval, new_len);
+            cur_len = new_len;
+        }
+    }
+
+    kvdb_uninit(client);
+
+    if (serial)
+        *serial = 0;
+
+    if (ret < 0 && ret != -EAGAIN && ret != -EEXIST)
+        return ret;
+
+    size_t len = cur_len < 0 ? 0 : cur_len;
+    if (out) {
+        len = MIN(len, out_len);
+        memcpy(out, cur, len);
+    }
+
+    return ret < 0 ? ret : (ssize_t)len;
+}
+
+/****************************************************************************
+ * Name: property_image_list
+ *
+ * Description:
+ *   Read all the pairs for property_snapshot().
+ *
+ ****************************************************************************/
+
+int property_image_list(kvdb_consume consume, void* cookie)
+{
+    return property_list_binary(consume, cookie);
+}
+
+/****************************************************************************
+ * Name: property_image_apply
+ *
+ * Description:
+ *   Apply the transaction made of a snapshot image for property_restore().
+ *
+ ****************************************************************************/
+
+int property_image_apply(const char* buf, size_t len)
+{
+    struct kvdb* client;
+    int ret = kvdb_init(&client);
+    if (ret < 0)
+        return ret;
+
+    ret = kvdb_txn_apply(client, buf, len, NULL, NULL);
+    kvdb_uninit(client);
+    return ret;
+}
+
+/****************************************************************************
+ * Name: property_txn_commit
+ *
+ * Description:
+ *   Apply all operations of the transaction at once and release it.
+ *
+ * Input Parameters:
+ *   struct property_txn* txn: handle returned by property_txn_begin()
+ *
+ * Returned Value:
+ *         0: success
+ *        <0: failure during execution
+ *
+ ****************************************************************************/
+
+int property_txn_commit(struct property_txn* txn)
+{
+    struct kvdb* client;
+    int ret;
+
+    if (!txn)
+        return -EINVAL;
+
+    ret = kvdb_init(&client);
+    if (ret >= 0) {
+        ret = kvdb_txn_apply(client, txn->buf, txn->len, NULL, NULL);
+        kvdb_uninit(client);
+    }
+
+    free(txn);
+    return ret;
+}
+
 /****************************************************************************
  * Name: property_commit
  *
@@ -18,10 +18,13 @@
  * Included Files
  ****************************************************************************/
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 
+#include <sys/stat.h>
+
 #include "internal.h"
 #include "kvdb.h"
 
@@ -38,23 +41,61 @@ static void kvdb_file_genpath(const char* path, const char* key, char* filepath)
     snprintf(filepath, PATH_MAX, "%s/%s", path, key);
 }
 
+/****************************************************************************
+ * kvdb_file_dir
+ ****************************************************************************/
+
+static const char* kvdb_file_dir(int shard, int index, char* buf)
+{
+    const char* path = CONFIG_KVDB_PERSIST_PATH;
+
+#ifdef CONFIG_KVDB_TEMPORARY_PATH
+    if (index == KVDB_MEM)
+        path = CONFIG_KVDB_TEMPORARY_PATH;
+#endif
+
+#ifdef CONFIG_KVDB_CONTEXTS
+    /* A shard is a directory next to the one of its store */
+
+    const struct kvdb_shard* info = kvdb_shard_get(shard);
+    if (info) {
+        snprintf(buf, PATH_MAX, "%s.%s", path, info->name);
+        return buf;
+    }
+#endif
+
+    return path;
+}
+
+/****************************************************************************
+ * kvdb_file_sync
+ ****************************************************************************/
+
+static bool kvdb_file_sync(int shard)
+{
+#ifdef CONFIG_KVDB_CONTEXTS
+    const struct kvdb_shard* info = kvdb_shard_get(shard);
+    return info && info->sync;
+#else
+    return false;
+#endif
+}
+
 /****************************************************************************
  * kvdb_file_set
  ****************************************************************************/
 
-static int kvdb_file_set(const char* path, const char* key, const void* value, size_t val_len)
+static int kvdb_file_set(const char* path, const char* key, const void* value, size_t val_len, bool sync)
 {
     char filepath[PATH_MAX];
     size_t nbyteswrite = 0;
     ssize_t result;
     int fd;
 
-    if (val_len >= PROP_VALUE_MAX) {
-        return -E2BIG;
-    }
-
     kvdb_file_genpath(path, key, filepath);
     fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0 && errno == ENOENT && mkdir(path, 0777) == 0) /* a new shard */
+        fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
     if (fd < 0) {
         KVERR("open %s error with %d", filepath, errno);
         return -errno;
@@ -75,6 +116,12 @@ static int kvdb_file_set(const char* path, const char* key, const void* value, s
         nbyteswrite += result;
     }
 
+    if (sync && fsync(fd) < 0) {
+        KVERR("sync %s error with %d", filepath, errno);
+        close(fd);
+        return -errno;
+    }
+
     close(fd);
     return 0;
 }
@@ -122,7 +169,7 @@ static ssize_t kvdb_file_get(const char* path, const char* key, void* value, siz
 
 static int kvdb_file_list(const char* path, kvdb_consume consume, void* cookie)
 {
-    char value[PROP_VALUE_MAX];
+    char value[KVDB_PACK_MAX];
     struct dirent* entry;
     DIR* dir;
     int ret;
@@ -138,13 +185,17 @@ static int kvdb_file_list(const char* path, kvdb_consume consume, void* cookie)
             continue;
         }
 
-        ret = kvdb_file_get(path, entry->d_name, value, PROP_VALUE_MAX);
+        ret = kvdb_file_get(path, entry->d_name, value, sizeof(value));
         if (ret < 0) {
             closedir(dir);
             return ret;
         }
 
+#ifdef CONFIG_KVDB_COMPRESS
+        kvdb_unpack_consume(consume, entry->d_name, value, ret, cookie);
+#else
         consume(entry->d_name, value, ret, cookie);
+#endif
     }
 
     closedir(dir);
@@ -183,6 +234,12 @@ static int kvdb_file_delete(const char* path, const char* key)
 
 int kvdb_init(struct kvdb** kvdb)
 {
+#ifdef CONFIG_KVDB_CONTEXTS
+    kvdb_shard_init();
+#endif
+#ifdef CONFIG_KVDB_COMPRESS
+    kvdb_dict_init(NULL);
+#endif
     return 0;
 }
 
@@ -205,13 +262,14 @@ void kvdb_uninit(struct kvdb* kvdb)
 }
 
 /****************************************************************************
- * Name: kvdb_set
+ * Name: kvdb_set_at
  *
  * Description:
- *   key-value set.
+ *   key-value set, the key lives at loc.
  *
  * Input Parameters:
  *   kvdb    - Pointer to save filekv instance.
+ *   loc     - Where the key lives, from kvdb_locate().
  *   key     - Pointer to key to set.
  *   key_len - the length of the key
  *   value   - Pointer to data to be saved
@@ -223,34 +281,63 @@ void kvdb_uninit(struct kvdb* kvdb)
  *
  ****************************************************************************/
 
-int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
-    const void* value, size_t val_len, bool force)
+int kvdb_set_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, const void* value, size_t val_len, bool force)
 {
-    int ret;
+    char buf[PATH_MAX];
 
     if (key == NULL || value == NULL)
         return -EINVAL;
 
-    ret = kvdb_get_index(key);
-    if (ret < 0)
-        return ret;
+    if (val_len >= PROP_VALUE_MAX)
+        return -E2BIG;
+
+    if (loc->index < 0)
+        return loc->index;
+
+    const char* path = kvdb_file_dir(loc->shard, loc->index, buf);
+    bool sync = kvdb_file_sync(loc->shard);
 
 #ifdef CONFIG_KVDB_TEMPORARY_PATH
-    if (ret == KVDB_MEM) {
-        return kvdb_file_set(CONFIG_KVDB_TEMPORARY_PATH, key, value, val_len);
+    if (loc->index == KVDB_MEM) {
+        return kvdb_file_set(path, key, value, val_len, sync);
     }
 #endif
-    return kvdb_file_set(CONFIG_KVDB_PERSIST_PATH, key, value, val_len);
+
+#ifdef CONFIG_KVDB_COMPRESS
+    char packed[KVDB_PACK_MAX];
+
+    ssize_t ret = kvdb_pack(key, value, val_len, packed);
+    if (ret < 0)
+        return ret;
+
+    return kvdb_file_set(path, key, packed, ret, sync);
+#else
+    return kvdb_file_set(path, key, value, val_len, sync);
+#endif
+}
+
+int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
+    const void* value, size_t val_len, bool force)
+{
+    struct kvdb_loc loc;
+
+    if (key == NULL)
+        return -EINVAL;
+
+    kvdb_locate(key, &loc);
+    return kvdb_set_at(kvdb, &loc, key, key_len, value, val_len, force);
 }
 
 /****************************************************************************
- * Name: kvdb_get
+ * Name: kvdb_get_at
  *
  * Description:
- *   key-value get.
+ *   key-value get, the key lives at loc.
  *
  * Input Parameters:
  *   kvdb    - Pointer to save filekv instance.
+ *   loc     - Where the key lives, from kvdb_locate().
  *   key     - Pointer to key to get.
  *   key_len - the length of the key
  *   value   - Pointer to data to be get
@@ -261,34 +348,58 @@ int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
  *
  ****************************************************************************/
 
-ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len)
+ssize_t kvdb_get_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, void* value, size_t val_len)
 {
-    int ret;
+    char buf[PATH_MAX];
 
     if (key == NULL || value == NULL)
         return -EINVAL;
 
-    ret = kvdb_get_index(key);
-    if (ret < 0) {
-        return ret;
-    }
+    if (loc->index < 0)
+        return loc->index;
+
+    const char* path = kvdb_file_dir(loc->shard, loc->index, buf);
 
 #ifdef CONFIG_KVDB_TEMPORARY_PATH
-    if (ret == KVDB_MEM) {
-        return kvdb_file_get(CONFIG_KVDB_TEMPORARY_PATH, key, value, val_len);
+    if (loc->index == KVDB_MEM) {
+        return kvdb_file_get(path, key, value, val_len);
     }
 #endif
-    return kvdb_file_get(CONFIG_KVDB_PERSIST_PATH, key, value, val_len);
+
+#ifdef CONFIG_KVDB_COMPRESS
+    char packed[KVDB_PACK_MAX];
+
+    ssize_t ret = kvdb_file_get(path, key, packed, sizeof(packed));
+    if (ret < 0)
+        return ret;
+
+    return kvdb_unpack(packed, ret, value, val_len);
+#else
+    return kvdb_file_get(path, key, value, val_len);
+#endif
+}
+
+ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len)
+{
+    struct kvdb_loc loc;
+
+    if (key == NULL)
+        return -EINVAL;
+
+    kvdb_locate(key, &loc);
+    return kvdb_get_at(kvdb, &loc, key, key_len, value, val_len);
 }
 
 /****************************************************************************
- * Name: kvdb_delete
+ * Name: kvdb_delete_at
  *
  * Description:
- *   key-value delete.
+ *   key-value delete, the key lives at loc.
  *
  * Input Parameters:
  *   kvdb    - Pointer to save filekv instance.
+ *   loc     - Where the key lives, from kvdb_locate().
  *   key     - Pointer to key to delete.
  *   key_len - the length of the key
  *
@@ -297,23 +408,33 @@ ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value
  *
  ****************************************************************************/
 
+int kvdb_delete_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key, size_t key_len)
+{
+    if (key == NULL)
+        return -EINVAL;
+
+#ifdef CONFIG_KVDB_COMPRESS
+    if (kvdb_dict_protect(key) < 0)
+        return -EPERM;
+#endif
+
+    if (loc->index < 0)
+        return loc->index;
+
+    char buf[PATH_MAX];
+
+    return kvdb_file_delete(kvdb_file_dir(loc->shard, loc->index, buf), key);
+}
+
 int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
 {
-    int ret;
+    struct kvdb_loc loc;
 
     if (key == NULL)
         return -EINVAL;
 
-    ret = kvdb_get_index(key);
-    if (ret < 0)
-        return ret;
-
-#ifdef CONFIG_KVDB_TEMPORARY_PATH
-    if (ret == KVDB_MEM) {
-        return kvdb_file_delete(CONFIG_KVDB_TEMPORARY_PATH, key);
-    }
-#endif
-    return kvdb_file_delete(CONFIG_KVDB_PERSIST_PATH, key);
+    kvdb_locate(key, &loc);
+    return kvdb_delete_at(kvdb, &loc, key, key_len);
 }
 
 /****************************************************************************
@@ -362,8 +483,25 @@ int kvdb_list(struct kvdb* kvdb, kvdb_consume consume, void* cookie)
         return ret;
 
 #ifdef CONFIG_KVDB_TEMPORARY_PATH
-    return kvdb_file_list(CONFIG_KVDB_TEMPORARY_PATH, consume, cookie);
-#else
-    return ret;
+    ret = kvdb_file_list(CONFIG_KVDB_TEMPORARY_PATH, consume, cookie);
+    if (ret < 0)
+        return ret;
 #endif
+
+#ifdef CONFIG_KVDB_CONTEXTS
+    /* A shard has no directory until its first key */
+
+    const struct kvdb_shard* info;
+    char buf[PATH_MAX];
+
+    for (int shard = KVDB_COUNT; (info = kvdb_shard_get(shard)) != NULL; shard++) {
+        ret = kvdb_file_list(kvdb_file_dir(shard, info->index, buf), consume, cookie);
+        if (ret == -ENOENT)
+            ret = 0;
+        else if (ret < 0)
+            return ret;
+    }
+#endif
+
+    return ret;
 }
@@ -16,11 +16,39 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <kvdb.h>
 
+/* Gets in flight on the session, their values must fit in the socket
+ * buffer or kvdbd blocks on them while we block on a send.
+ */
+
+#define GETPROP_WINDOW 4
+
+/* Gets of a batch, pipelined over one session with kvdbd or served in
+ * place with CONFIG_KVDB_DIRECT.
+ */
+
+struct getprop_batch {
+    struct property_async* async;
+    int pending;
+    int err;
+};
+
+/* A get in flight, the reply doesn't carry the key */
+
+struct getprop_req {
+    struct getprop_batch* batch;
+    char key[];
+};
+
 #ifdef CONFIG_KVDB_DUMPLIST
 static void callback(const char* name, const void* value, size_t val_len, void* cookie)
 {
@@ -46,11 +74,229 @@ static void callback(const char* name, const void* value, size_t val_len, void*
 }
 #endif
 
+static void getprop_print(struct getprop_batch* batch, const char* key, int err,
+    const void* value, size_t val_len)
+{
+    if (err < 0) {
+        printf("%s: Error: %s\n", key, strerror(-err));
+        batch->err = err;
+    } else
+        callback(key, value, val_len, NULL);
+}
+
+#ifndef CONFIG_KVDB_DIRECT
+static void getprop_done(int err, const char* key, const void* value, size_t val_len, void* cookie)
+{
+    struct getprop_req* req = cookie;
+
+    (void)key;
+    req->batch->pending--;
+    getprop_print(req->batch, req->key, err, value, val_len);
+    free(req);
+}
+
+/* Run the callbacks until at most max gets are in flight */
+static int getprop_wait(struct getprop_batch* batch, int max)
+{
+    while (batch->pending > max) {
+        struct pollfd pfd = { .fd = property_async_fd(batch->async), .events = POLLIN };
+
+        if (poll(&pfd, 1, -1) < 0)
+            return -errno;
+
+        int ret = property_async_dispatch(batch->async);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+#endif
+
+static int getprop_submit(struct getprop_batch* batch, const char* key)
+{
+#ifdef CONFIG_KVDB_DIRECT
+    char buf[PROP_VALUE_MAX];
+
+    ssize_t len = property_get_binary(key, buf, sizeof(buf));
+    getprop_print(batch, key, len < 0 ? len : 0, buf, len);
+    return 0;
+#else
+    size_t key_len = strlen(key) + 1;
+    struct getprop_req* req = malloc(sizeof(struct getprop_req) + key_len);
+    if (req == NULL)
+        return -ENOMEM;
+
+    req->batch = batch;
+    memcpy(req->key, key, key_len);
+
+    int max = GETPROP_WINDOW - 1;
+    int ret;
+
+    do {
+        ret = getprop_wait(batch, max);
+        if (ret < 0)
+            break;
+
+        ret = property_async_get(batch->async, key, getprop_done, req);
+
+        /* The socket is full, let kvdbd catch up */
+        max = batch->pending - 1;
+    } while (ret == -EAGAIN && max >= 0);
+
+    if (ret >= 0) {
+        batch->pending++;
+        return 0;
+    }
+
+    free(req);
+
+    /* A refused key fails the batch, the connection is still good */
+    if (ret != -EINVAL && ret != -E2BIG)
+        return ret;
+
+    getprop_print(batch, key, ret, NULL, 0);
+    return 0;
+#endif
+}
+
+/* Print the keys listed in file, one per line, "-" for stdin, or in argv */
+static int getprop_batch(const char* file, char* argv[], int argc)
+{
+    struct getprop_batch batch = { 0 };
+    int ret = 0;
+
+#ifndef CONFIG_KVDB_DIRECT
+    batch.async = property_async_open();
+    if (batch.async == NULL)
+        return -errno;
+#endif
+
+    if (file) {
+        FILE* fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+        char line[PROP_NAME_MAX + 2];
+
+        if (fp == NULL)
+            ret = -errno;
+
+        while (fp && ret >= 0 && fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] != '\0' && line[0] != '#')
+                ret = getprop_submit(&batch, line);
+        }
+
+        if (fp && fp != stdin)
+            fclose(fp);
+    } else {
+        for (int i = 0; ret >= 0 && i < argc; i++)
+            ret = getprop_submit(&batch, argv[i]);
+    }
+
+#ifndef CONFIG_KVDB_DIRECT
+    if (ret >= 0)
+        ret = getprop_wait(&batch, 0);
+    property_async_close(batch.async);
+#endif
+
+    return ret < 0 ? ret : batch.err;
+}
+
+#ifndef CONFIG_KVDB_DIRECT
+
+/* The offset of our clock to the one of kvdbd, 0 on its own core */
+
+struct getprop_watch {
+    uint32_t offset;
+    int err;
+};
+
+static void getprop_change(int stamp, const char* key, const void* value, size_t val_len, void* cookie)
+{
+    struct getprop_watch* watch = cookie;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint32_t now = ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000) & INT32_MAX;
+
+    if (stamp < 0) {
+        printf("Error: %s\n", strerror(-stamp));
+        watch->err = stamp;
+        return;
+    }
+
+    /* The watch is in place. Another core has its own clock, half the
+     * round trip of the subscription ends up in the latencies.
+     */
+
+    if (key == NULL) {
+#ifndef CONFIG_KVDB_SERVER
+        watch->offset = (now - stamp) & INT32_MAX;
+#endif
+        return;
+    }
+
+    uint32_t latency = (now - watch->offset - stamp) & INT32_MAX;
+    if (latency > INT32_MAX / 2)
+        latency = 0; /* a bit ahead with the offset */
+
+    printf("[%5ld.%06ld] +%luus ", (long)ts.tv_sec, ts.tv_nsec / 1000, (unsigned long)latency);
+    if (val_len)
+        callback(key, value, val_len, NULL);
+    else
+        printf("%s: (deleted)\n", key);
+}
+
+/* Print the changes of the keys matching pattern until interrupted */
+static int getprop_watch(const char* pattern)
+{
+    struct getprop_watch watch = { 0 };
+
+    struct property_async* async = property_async_open();
+    if (async == NULL)
+        return -errno;
+
+    int ret = property_async_watch(async, pattern, getprop_change, &watch);
+    while (ret >= 0 && watch.err == 0) {
+        struct pollfd pfd = { .fd = property_async_fd(async), .events = POLLIN };
+
+        ret = poll(&pfd, 1, -1);
+        if (ret >= 0)
+            ret = property_async_dispatch(async);
+        fflush(stdout);
+    }
+
+    property_async_close(async);
+    return ret < 0 ? ret : watch.err;
+}
+#endif
+
 int main(int argc, char* argv[])
 {
     int ret = 0;
 
-    if (argc == 2 && strncmp(argv[1], "-h", 3)) {
+    if (argc == 2 && !strcmp(argv[1], "--stats"))
+        ret = -property_stats(callback, NULL);
+    else if (argc == 2 && !strcmp(argv[1], "--trace"))
+        ret = -property_trace(0, callback, NULL);
+    else if (argc == 2 && !strcmp(argv[1], "--trace-raw"))
+        ret = -property_trace(1, callback, NULL);
+    else if (argc == 3 && !strcmp(argv[1], "--snapshot")) {
+        int fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return errno;
+
+        ret = -property_snapshot(fd);
+        close(fd);
+    }
+    else if (argc == 3 && !strcmp(argv[1], "-f"))
+        ret = -getprop_batch(argv[2], NULL, 0);
+#ifndef CONFIG_KVDB_DIRECT
+    else if (argc == 3 && !strcmp(argv[1], "-w"))
+        ret = -getprop_watch(argv[2]);
+#endif
+    else if (argc >= 3)
+        ret = -getprop_batch(NULL, argv + 1, argc - 1);
+    else if (argc == 2 && strncmp(argv[1], "-h", 3)) {
         char buf[PROP_VALUE_MAX];
 
         ssize_t len = property_get_binary(argv[1], buf, sizeof(buf));
@@ -64,7 +310,7 @@ int main(int argc, char* argv[])
         ret = -property_list_binary(callback, NULL);
 #endif
     else
-        printf("Usage: %s [key]\n", argv[0]);
+        printf("Usage: %s [key... | -f file | -w pattern | --stats | --trace | --trace-raw | --snapshot file]\n", argv[0]);
 
     return ret;
 }
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Included before every source of the host build, see CMakeLists.txt here.
+ * It stands in for the NuttX libc extensions and the Kconfig defaults.
+ */
+
+#ifndef __KVDB_HOST_H
+#define __KVDB_HOST_H
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netpacket/rpmsg.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#ifndef CONFIG_KVDB_PRIORITY
+#define CONFIG_KVDB_PRIORITY 100
+#endif
+
+#ifndef CONFIG_KVDB_STACKSIZE
+#define CONFIG_KVDB_STACKSIZE 4096
+#endif
+
+#ifndef CONFIG_KVDB_TIMEOUT_INTERVAL
+#define CONFIG_KVDB_TIMEOUT_INTERVAL 0
+#endif
+
+#ifndef CONFIG_KVDB_CONNECT_TIMEOUT
+#define CONFIG_KVDB_CONNECT_TIMEOUT 0
+#endif
+
+#ifndef CONFIG_KVDB_COMMIT_INTERVAL
+#define CONFIG_KVDB_COMMIT_INTERVAL 5
+#endif
+
+#ifndef CONFIG_KVDB_NOTIFY_INTERVAL
+#define CONFIG_KVDB_NOTIFY_INTERVAL 0
+#endif
+
+#ifndef CONFIG_KVDB_NOTIFY_BUFFER
+#define CONFIG_KVDB_NOTIFY_BUFFER 4096
+#endif
+
+#ifndef CONFIG_KVDB_LOCAL_WEIGHT
+#define CONFIG_KVDB_LOCAL_WEIGHT 4
+#endif
+
+#ifndef CONFIG_KVDB_REMOTE_WEIGHT
+#define CONFIG_KVDB_REMOTE_WEIGHT 1
+#endif
+
+#ifndef CONFIG_KVDB_CONTEXTS_MAX
+#define CONFIG_KVDB_CONTEXTS_MAX 8
+#endif
+
+#ifndef CONFIG_KVDB_BULK_SLICE
+#define CONFIG_KVDB_BULK_SLICE 16
+#endif
+
+#ifndef CONFIG_KVDB_SERVER_CPUNAME
+#define CONFIG_KVDB_SERVER_CPUNAME "ap"
+#endif
+
+#ifndef UNUSED
+#define UNUSED(x) ((void)(x))
+#endif
+
+/* glibc's sys/queue.h has no _SAFE iterators */
+
+#ifndef LIST_FOREACH_SAFE
+#define LIST_FOREACH_SAFE(var, head, field, tvar)                       \
+    for ((var) = LIST_FIRST((head));                                    \
+         (var) && ((tvar) = LIST_NEXT((var), field), 1); (var) = (tvar))
+#endif
+
+#ifndef TAILQ_FOREACH_SAFE
+#define TAILQ_FOREACH_SAFE(var, head, field, tvar)                       \
+    for ((var) = TAILQ_FIRST((head));                                    \
+         (var) && ((tvar) = TAILQ_NEXT((var), field), 1); (var) = (tvar))
+#endif
+
+/* Renamed so they never clash with a libc which has them */
+
+#define zalloc kvdb_host_zalloc
+#define strlcpy kvdb_host_strlcpy
+#define socket(d, t, p) kvdb_host_socket(d, t, p)
+#define bind(s, a, l) kvdb_host_bind(s, a, l)
+#define connect(s, a, l) kvdb_host_connect(s, a, l)
+
+/****************************************************************************
+ * Inline Functions
+ ****************************************************************************/
+
+static inline void* kvdb_host_zalloc(size_t size)
+{
+    return calloc(1, size);
+}
+
+static inline size_t kvdb_host_strlcpy(char* dst, const char* src, size_t size)
+{
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len < size ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+
+    return len;
+}
+
+/* Both transports become abstract AF_UNIX sockets: AF_RPMSG is named after
+ * the endpoint with the cpu name dropped since every "cpu" is this host,
+ * and the relative NuttX local socket paths would otherwise land in cwd.
+ */
+
+static inline int kvdb_host_socket(int domain, int type, int protocol)
+{
+    return (socket)(domain == AF_RPMSG ? AF_UNIX : domain, type, protocol);
+}
+
+static inline socklen_t kvdb_host_addr(const struct sockaddr* addr, socklen_t addrlen,
+    struct sockaddr_un* un)
+{
+    const char* prefix;
+    const char* name;
+
+    if (addr->sa_family == AF_RPMSG) {
+        prefix = "rpmsg:";
+        name = ((const struct sockaddr_rpmsg*)addr)->rp_name;
+    } else if (addr->sa_family == AF_UNIX && ((const struct sockaddr_un*)addr)->sun_path[0] != '/') {
+        prefix = "local:";
+        name = ((const struct sockaddr_un*)addr)->sun_path;
+    } else {
+        return 0;
+    }
+
+    memset(un, 0, sizeof(*un));
+    un->sun_family = AF_UNIX;
+    snprintf(un->sun_path + 1, sizeof(un->sun_path) - 1, "%s%.*s", prefix,
+        (int)(sizeof(un->sun_path) - 8), name);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(un->sun_path + 1);
+}
+
+static inline int kvdb_host_bind(int fd, const struct sockaddr* addr, socklen_t addrlen)
+{
+    struct sockaddr_un un;
+    socklen_t len = kvdb_host_addr(addr, addrlen, &un);
+
+    if (len)
+        return (bind)(fd, (const struct sockaddr*)&un, len);
+
+    return (bind)(fd, addr, addrlen);
+}
+
+static inline int kvdb_host_connect(int fd, const struct sockaddr* addr, socklen_t addrlen)
+{
+    struct sockaddr_un un;
+    socklen_t len = kvdb_host_addr(addr, addrlen, &un);
+
+    if (len == 0)
+        return (connect)(fd, addr, addrlen);
+
+    /* Until kvdbd is up the NuttX path doesn't exist, clients retry on that */
+
+    int ret = (connect)(fd, (const struct sockaddr*)&un, len);
+    if (ret < 0 && errno == ECONNREFUSED)
+        errno = ENOENT;
+
+    return ret;
+}
+
+#endif /* __KVDB_HOST_H */
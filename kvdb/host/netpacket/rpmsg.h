@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* The NuttX rpmsg socket address for the host build, host.h routes it to
+ * an abstract AF_UNIX socket.
+ */
+
+#ifndef __KVDB_HOST_NETPACKET_RPMSG_H
+#define __KVDB_HOST_NETPACKET_RPMSG_H
+
+#include <sys/socket.h>
+
+#define AF_RPMSG (AF_MAX + 1)
+#define PF_RPMSG AF_RPMSG
+
+#define RPMSG_SOCKET_CPU_SIZE 16
+#define RPMSG_SOCKET_NAME_SIZE 32
+
+struct sockaddr_rpmsg {
+    sa_family_t rp_family;
+    char rp_cpu[RPMSG_SOCKET_CPU_SIZE];
+    char rp_name[RPMSG_SOCKET_NAME_SIZE];
+};
+
+#endif /* __KVDB_HOST_NETPACKET_RPMSG_H */
@@ -17,7 +17,10 @@
 #ifndef __INTERNAL_H
 #define __INTERNAL_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <syslog.h>
 
 #define KVLOG(level, fmt, ...) \
@@ -42,6 +45,85 @@
 #endif
 
 #define PROP_SERVER_PATH "kvdbd"
+#define PROP_REPLICA_PATH "kvdbr"
+
+/* The biggest request, 'X' carries two values */
+
+#define KVDB_MSG_MAX (5 + PROP_NAME_MAX + 2 * PROP_VALUE_MAX)
+
+/* Requests on a session, which is opened by a leading 'P'
+ *---------------------------------------------------*
+ | 1 |   1   |   1   |  1  | 4 | key_len | val_len |
+ |---------------------------------------------------|
+ |op |key_len|val_len|flags|id |[key'\0']| [value] |
+ *---------------------------------------------------*/
+
+struct kvdb_frame {
+    uint8_t op;
+    uint8_t key_len;
+    uint8_t val_len;
+    uint8_t flags;
+    uint32_t id;
+};
+
+/* 'M' with this flag gets the time of every change on the server in the
+ * error of its notifications, us modulo 2^31, and the current one in the
+ * reply.
+ */
+
+#define KVDB_FLAG_STAMP 0x01
+
+/* A request with this flag carries after its value the deadline of its
+ * caller, 4 bytes not counted in val_len: the CLOCK_MONOTONIC time in ms,
+ * modulo 2^32, from a local client which shares the clock of the server,
+ * the ms left from a remote one. The server replies -ETIMEDOUT without
+ * serving the request once the deadline is over.
+ */
+
+#define KVDB_FLAG_DEADLINE 0x02
+
+/* The length of a request frame, the deadline included */
+
+#define KVDB_FRAME_LEN(req) (sizeof(struct kvdb_frame) + (req)->key_len \
+    + (req)->val_len + ((req)->flags & KVDB_FLAG_DEADLINE ? 4 : 0))
+
+/* Replies and notifications ('N') on a session
+ *---------------------------------------------------------*
+ | 1 |   1   |   1   |  1  | 4 |  4  | key_len | val_len |
+ |---------------------------------------------------------|
+ |op |key_len|val_len|flags|id |error|[key'\0']| [value] |
+ *---------------------------------------------------------*/
+
+struct kvdb_reply {
+    struct kvdb_frame hdr;
+    int32_t err;
+};
+
+#define KVDB_FRAME_MAX (sizeof(struct kvdb_reply) + PROP_NAME_MAX + PROP_VALUE_MAX)
+
+#ifndef CONFIG_KVDB_TRANSACTION_SIZE
+#define CONFIG_KVDB_TRANSACTION_SIZE 4096
+#endif
+
+#ifndef CONFIG_KVDB_RESTORE_SIZE
+#define CONFIG_KVDB_RESTORE_SIZE 65536
+#endif
+
+/* A snapshot image, the records share the layout of 'L' and a 0 key_len
+ * ends the image:
+ *-----------------------------------------------------*
+ |  4   | 1 |   1   |   1   | key_len |val_len| ... | 2 |
+ |-----------------------------------------------------|
+ |"KVDB"|ver|key_len|val_len|[key'\0']|[value]| ... |0 0|
+ *-----------------------------------------------------*/
+
+#define KVDB_IMAGE_MAGIC "KVDB"
+#define KVDB_IMAGE_VERSION 1
+
+/* A restore turns every image record into a set and adds its 1 byte op,
+ * a record takes at least 5 bytes so the transaction grows by a fifth.
+ */
+#define KVDB_RESTORE_MAX (CONFIG_KVDB_RESTORE_SIZE + CONFIG_KVDB_RESTORE_SIZE / 5)
 
 #if defined(__cplusplus)
 extern "C" {
@@ -62,19 +144,118 @@ enum {
     KVDB_COUNT
 };
 
+/* The databases of a backend are the stores above, then the shards named
+ * in CONFIG_KVDB_CONTEXTS_PATH. A shard belongs to one store and lives in
+ * a database of its own next to it.
+ */
+
+#ifdef CONFIG_KVDB_CONTEXTS
+#define KVDB_SHARD_MAX (KVDB_COUNT + CONFIG_KVDB_CONTEXTS_MAX)
+#define KVDB_SHARD_NAME_MAX 32
+
+struct kvdb_shard {
+    char name[KVDB_SHARD_NAME_MAX];
+    int index; /* the store, KVDB_PERSIST or KVDB_MEM */
+    bool sync; /* commit on every write */
+};
+
+int kvdb_shard_init(void);
+int kvdb_get_shard(const char* key, int index);
+const struct kvdb_shard* kvdb_shard_get(int shard);
+#else
+#define KVDB_SHARD_MAX KVDB_COUNT
+#define kvdb_get_shard(key, index) (index)
+#endif
+
 struct kvdb;
 
+/* Transaction records share the 'S' layout, deletes have no value:
+ *-------------------------------------*
+ | 1 |   1   |   1   | key_len |val_len|
+ |-------------------------------------|
+ |op |key_len|val_len|[key'\0']|[value]|
+ *-------------------------------------*/
+
+struct property_txn {
+    size_t len;
+    char buf[CONFIG_KVDB_TRANSACTION_SIZE];
+};
+
 typedef void (*kvdb_consume)(const char* key, const void* value, size_t val_len, void* cookie);
 
+/* Where a key lives, its store and its database. kvdbd keeps it with the
+ * keys it has seen and passes it to the _at calls, the others work it out
+ * from the key on every call.
+ */
+
+struct kvdb_loc {
+    int index; /* from kvdb_get_index(), -errno if the key has no store */
+    int shard; /* from kvdb_get_shard() */
+};
+
 int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len, const void* value, size_t val_len, bool force);
 ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len);
 int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len);
+int kvdb_set_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, const void* value, size_t val_len, bool force);
+ssize_t kvdb_get_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, void* value, size_t val_len);
+int kvdb_delete_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key, size_t key_len);
 int kvdb_list(struct kvdb* kvdb, kvdb_consume consume, void* cookie);
 int kvdb_commit(struct kvdb* kvdb);
 int kvdb_init(struct kvdb** kvdb);
 void kvdb_uninit(struct kvdb* kvdb);
 
+int kvdb_txn_apply(struct kvdb* kvdb, const char* buf, size_t len, kvdb_consume consume, void* cookie);
+
+/* The transport side of property_snapshot() and property_restore() */
+
+int property_image_list(kvdb_consume consume, void* cookie);
+int property_image_apply(const char* buf, size_t len);
+
+#ifdef CONFIG_KVDB_COMPACT
+struct kvdb_compact_info {
+    uint32_t runs; /* compactions done */
+    uint32_t aborted; /* restarted as the database changed */
+    size_t copied; /* entries copied by the last or the current one */
+    int64_t reclaimed; /* bytes */
+};
+
+int kvdb_compact(struct kvdb* kvdb, size_t count, struct kvdb_compact_info* info);
+#endif
+
+/* The size of a value as stored, compression makes it at most one byte
+ * longer. The dictionary and the mark of the packed format are hidden
+ * persist values.
+ */
+
+#ifdef CONFIG_KVDB_COMPRESS
+#define KVDB_PACK_MAX (PROP_VALUE_MAX + 1)
+#define KVDB_DICT_KEY PERSIST_LABEL "kvdb.dict"
+#define KVDB_FORMAT_KEY PERSIST_LABEL "kvdb.packed"
+
+void kvdb_dict_init(struct kvdb* kvdb);
+int kvdb_dict_protect(const char* key);
+ssize_t kvdb_pack(const char* key, const void* value, size_t val_len, void* buf);
+ssize_t kvdb_unpack(const void* buf, size_t len, void* value, size_t val_len);
+void kvdb_unpack_consume(kvdb_consume consume, const char* key,
+    const void* value, size_t val_len, void* cookie);
+#else
+#define KVDB_PACK_MAX PROP_VALUE_MAX
+#endif
+
 int kvdb_get_index(const char* key);
+void kvdb_locate(const char* key, struct kvdb_loc* loc);
+const char* kvdb_getenv(const char* key);
+ssize_t kvdb_env_get(const char* key, void* value, size_t val_len);
+int kvdb_env_set(const char* key, const void* value, size_t val_len);
+int64_t kvdb_uptime_ms(void);
+uint32_t kvdb_deadline(int64_t deadline);
+int property_connect(void);
+int property_connect_timeout(int timeout);
+int kvdb_atomic_eval(int type, const void* cur, ssize_t cur_len, uint32_t serial,
+    const void* arg, size_t arg_len, const void* value, size_t val_len,
+    void* newval, size_t* new_len);
 
 #if defined(__cplusplus)
 }
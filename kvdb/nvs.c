@@ -41,9 +41,18 @@ struct kvdb {
  * Private Functions
  ****************************************************************************/
 
-static const char* kvdb_skip_prefix(const char* key, int index)
+/* Copy the name of the key in its store, without the persist label */
+static int kvdb_copy_name(char* name, size_t size, const char* key,
+    size_t key_len, int index)
 {
-    return index == KVDB_PERSIST ? key + PERSIST_LABEL_LEN : key;
+    size_t skip = index == KVDB_PERSIST ? PERSIST_LABEL_LEN : 0;
+
+    if (key_len <= skip || key_len - skip > size)
+        return -EINVAL;
+
+    memcpy(name, key + skip, key_len - skip - 1);
+    name[key_len - skip - 1] = '\0';
+    return 0;
 }
 
 static void kvdb_add_prefix(char* out, size_t outlen,
@@ -57,6 +66,16 @@ static void kvdb_add_prefix(char* out, size_t outlen,
     }
 }
 
+static void kvdb_list_consume(kvdb_consume consume, const char* key,
+    const void* value, size_t val_len, void* cookie)
+{
+#ifdef CONFIG_KVDB_COMPRESS
+    kvdb_unpack_consume(consume, key, value, val_len, cookie);
+#else
+    consume(key, value, val_len, cookie);
+#endif
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
@@ -109,6 +128,10 @@ int kvdb_init(struct kvdb** kvdb)
 #endif
     *kvdb = handle;
 
+#ifdef CONFIG_KVDB_COMPRESS
+    kvdb_dict_init(handle);
+#endif
+
     return 0;
 
 err:
@@ -147,13 +170,14 @@ void kvdb_uninit(struct kvdb* kvdb)
 }
 
 /****************************************************************************
- * Name: kvdb_set
+ * Name: kvdb_set_at
  *
  * Description:
- *   key-value set.
+ *   key-value set, the key lives at loc.
  *
  * Input Parameters:
  *   kvdb    - Pointer to save nvs kvdb instance.
+ *   loc     - Where the key lives, from kvdb_locate().
  *   key     - Pointer to key to set.
  *   key_len - the length of the key
  *   value   - Pointer to data to be saved
@@ -165,26 +189,35 @@ void kvdb_uninit(struct kvdb* kvdb)
  *
  ****************************************************************************/
 
-int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
-    const void* value, size_t val_len, bool force)
+int kvdb_set_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, const void* value, size_t val_len, bool force)
 {
     struct config_data_s data;
-    int index;
+    int index = loc->index;
     int ret;
 
     if (key == NULL || key_len == 0)
         return -EINVAL;
 
-    index = kvdb_get_index(key);
     if (index < 0)
         return index;
 
-    key = kvdb_skip_prefix(key, index);
+#ifdef CONFIG_KVDB_COMPRESS
+    uint8_t packed[KVDB_PACK_MAX];
 
-    if (strlen(key) >= sizeof(data.name))
-        return -EINVAL;
+    if (index == KVDB_PERSIST) {
+        ssize_t len = kvdb_pack(key, value, val_len, packed);
+        if (len < 0)
+            return len;
 
-    strlcpy(data.name, key, sizeof(data.name));
+        value = packed;
+        val_len = len;
+    }
+#endif
+
+    ret = kvdb_copy_name(data.name, sizeof(data.name), key, key_len, index);
+    if (ret < 0)
+        return ret;
 
     data.len = val_len;
     data.configdata = (uint8_t*)value;
@@ -198,14 +231,27 @@ int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
     return ret;
 }
 
+int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
+    const void* value, size_t val_len, bool force)
+{
+    struct kvdb_loc loc;
+
+    if (key == NULL)
+        return -EINVAL;
+
+    kvdb_locate(key, &loc);
+    return kvdb_set_at(kvdb, &loc, key, key_len, value, val_len, force);
+}
+
 /****************************************************************************
- * Name: kvdb_get
+ * Name: kvdb_get_at
  *
  * Description:
- *   key-value get.
+ *   key-value get, the key lives at loc.
  *
  * Input Parameters:
  *   kvdb    - Pointer to save nvs kvdb instance.
+ *   loc     - Where the key lives, from kvdb_locate().
  *   key     - Pointer to key to get.
  *   key_len - the length of the key
  *   value   - Pointer to data to be get
@@ -216,28 +262,35 @@ int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len,
  *
  ****************************************************************************/
 
-ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len)
+ssize_t kvdb_get_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, void* value, size_t val_len)
 {
     struct config_data_s data;
-    int index;
+    int index = loc->index;
     int ret;
 
     if (key == NULL || key_len == 0)
         return -EINVAL;
 
-    index = kvdb_get_index(key);
     if (index < 0)
         return index;
 
-    key = kvdb_skip_prefix(key, index);
-
-    if (strlen(key) >= sizeof(data.name))
-        return -EINVAL;
+    ret = kvdb_copy_name(data.name, sizeof(data.name), key, key_len, index);
+    if (ret < 0)
+        return ret;
 
-    strlcpy(data.name, key, sizeof(data.name));
     data.configdata = (uint8_t*)value;
     data.len = val_len;
 
+#ifdef CONFIG_KVDB_COMPRESS
+    uint8_t packed[KVDB_PACK_MAX];
+
+    if (index == KVDB_PERSIST) {
+        data.configdata = packed;
+        data.len = sizeof(packed);
+    }
+#endif
+
     ret = ioctl(kvdb->fd[index], CFGDIOC_GETCONFIG, &data);
     if (ret < 0) {
         ret = -errno;
@@ -245,17 +298,34 @@ ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value
         return ret;
     }
 
+#ifdef CONFIG_KVDB_COMPRESS
+    if (index == KVDB_PERSIST)
+        return kvdb_unpack(packed, data.len, value, val_len);
+#endif
+
     return data.len;
 }
 
+ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len)
+{
+    struct kvdb_loc loc;
+
+    if (key == NULL)
+        return -EINVAL;
+
+    kvdb_locate(key, &loc);
+    return kvdb_get_at(kvdb, &loc, key, key_len, value, val_len);
+}
+
 /****************************************************************************
- * Name: kvdb_delete
+ * Name: kvdb_delete_at
  *
  * Description:
- *   key-value delete.
+ *   key-value delete, the key lives at loc.
  *
  * Input Parameters:
  *   kvdb    - Pointer to save nvs kvdb instance.
+ *   loc     - Where the key lives, from kvdb_locate().
  *   key     - Pointer to key to delete.
  *   key_len - the length of the key
  *
@@ -264,25 +334,26 @@ ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value
  *
  ****************************************************************************/
 
-int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
+int kvdb_delete_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key, size_t key_len)
 {
     struct config_data_s data;
-    int index;
+    int index = loc->index;
     int ret;
 
     if (key == NULL || key_len == 0)
         return -EINVAL;
 
-    index = kvdb_get_index(key);
+#ifdef CONFIG_KVDB_COMPRESS
+    if (kvdb_dict_protect(key) < 0)
+        return -EPERM;
+#endif
+
     if (index < 0)
         return index;
 
-    key = kvdb_skip_prefix(key, index);
-
-    if (strlen(key) >= sizeof(data.name))
-        return -EINVAL;
-
-    strlcpy(data.name, key, sizeof(data.name));
+    ret = kvdb_copy_name(data.name, sizeof(data.name), key, key_len, index);
+    if (ret < 0)
+        return ret;
 
     ret = ioctl(kvdb->fd[index], CFGDIOC_DELCONFIG, &data);
     if (ret < 0) {
@@ -293,6 +364,17 @@ int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
     return ret;
 }
 
+int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
+{
+    struct kvdb_loc loc;
+
+    if (key == NULL)
+        return -EINVAL;
+
+    kvdb_locate(key, &loc);
+    return kvdb_delete_at(kvdb, &loc, key, key_len);
+}
+
 /****************************************************************************
  * Name: kvdb_list
  *
@@ -312,7 +394,7 @@ int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
 int kvdb_list(struct kvdb* kvdb, kvdb_consume consume, void* cookie)
 {
     char key[CONFIG_NAME_MAX + PERSIST_LABEL_LEN];
-    uint8_t buf[PROP_VALUE_MAX];
+    uint8_t buf[KVDB_PACK_MAX];
     struct config_data_s data;
     int i;
 
@@ -321,25 +403,25 @@ int kvdb_list(struct kvdb* kvdb, kvdb_consume consume, void* cookie)
 
     for (i = 0; i < KVDB_COUNT; i++) {
         data.configdata = buf;
-        data.len = PROP_VALUE_MAX;
+        data.len = sizeof(buf);
         int ret = ioctl(kvdb->fd[i], CFGDIOC_FIRSTCONFIG, &data);
         if (ret < 0)
             continue;
 
         kvdb_add_prefix(key, sizeof(key), i, data.name);
 
-        consume(key, data.configdata, data.len, cookie);
+        kvdb_list_consume(consume, key, data.configdata, data.len, cookie);
 
         while (1) {
             data.configdata = buf;
-            data.len = PROP_VALUE_MAX;
+            data.len = sizeof(buf);
             ret = ioctl(kvdb->fd[i], CFGDIOC_NEXTCONFIG, &data);
             if (ret < 0)
                 break;
 
             kvdb_add_prefix(key, sizeof(key), i, data.name);
 
-            consume(key, data.configdata, data.len, cookie);
+            kvdb_list_consume(consume, key, data.configdata, data.len, cookie);
         }
     }
 
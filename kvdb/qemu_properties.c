@@ -27,6 +27,7 @@
 #include <kvdb.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -37,6 +38,7 @@
 
 #define MAX_TRIES 5
 #define BUFF_SIZE (PROPERTY_KEY_MAX + PROPERTY_VALUE_MAX + 2)
+#define PROPS_GROW 1024
 
 /****************************************************************************
  * Private Functions
@@ -121,12 +123,81 @@ qemud_channel_recv(int pipe, void* msg, int maxsize)
     return size;
 }
 
+/* Apply one transaction of the records in buf, "key\0value\0" each. A
+ * refused one, like with an "ro." key set already, is retried key by key
+ * so the others still get in.
+ */
+
+static void
+qemu_props_commit(struct property_txn* txn, const char* buf, size_t len)
+{
+    if (property_txn_commit(txn) >= 0) {
+        return;
+    }
+
+    for (size_t pos = 0; pos < len; ) {
+        const char* key = buf + pos;
+        const char* value = key + strlen(key) + 1;
+
+        property_set(key, value);
+        pos = value + strlen(value) + 1 - buf;
+    }
+}
+
+/* Set all the received properties with as few transactions as fit them */
+
+static void
+qemu_props_apply(const char* buf, size_t len)
+{
+    struct property_txn* txn = NULL;
+    size_t start = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        const char* key = buf + pos;
+        const char* value = key + strlen(key) + 1;
+        size_t next = value + strlen(value) + 1 - buf;
+
+        if (txn == NULL) {
+            txn = property_txn_begin();
+            if (txn == NULL) {
+                fprintf(stderr, "no memory for the properties\n");
+                return;
+            }
+        }
+
+        int ret = property_txn_set(txn, key, value);
+        if (ret == -E2BIG && pos > start) {
+            /* full, the record goes into the next one */
+
+            qemu_props_commit(txn, buf + start, pos - start);
+            txn = NULL;
+            start = pos;
+            continue;
+        }
+
+        if (ret < 0) {
+            fprintf(stderr, "skip %s: %s\n", key, strerror(-ret));
+        }
+
+        pos = next;
+    }
+
+    if (txn != NULL) {
+        qemu_props_commit(txn, buf + start, pos - start);
+    }
+}
+
 /****************************************************************************
  * Public Functions
  ****************************************************************************/
 
-int main(void)
+int main(int argc, char* argv[])
 {
+    bool verbose = argc == 2 && !strcmp(argv[1], "-v");
+    char* props = NULL;
+    size_t props_len = 0;
+    size_t props_size = 0;
     int qemud_fd;
 
     /* try to connect to the qemud service */
@@ -159,7 +230,7 @@ int main(void)
     }
 
     /* read each system property as a single line from the service,
-     * until exhaustion.
+     * until exhaustion, and keep it for a single batch.
      */
 
     while (true) {
@@ -187,13 +258,31 @@ int main(void)
         *prop_value = '\0';
         ++prop_value;
 
-        fprintf(stderr, "key = %s | value = %s\n", prop_key, prop_value);
-        if (property_set(prop_key, prop_value) < 0) {
-            continue;
+        if (verbose) {
+            fprintf(stderr, "key = %s | value = %s\n", prop_key, prop_value);
+        }
+
+        if (props_len + len + 1 > props_size) {
+            char* tmp = realloc(props, props_size + PROPS_GROW);
+            if (tmp == NULL) {
+                fprintf(stderr, "no memory for %s\n", prop_key);
+                continue;
+            }
+
+            props = tmp;
+            props_size += PROPS_GROW;
         }
+
+        /* "key\0value\0" */
+
+        memcpy(props + props_len, temp, len + 1);
+        props_len += len + 1;
     }
 
     close(qemud_fd);
 
+    qemu_props_apply(props, props_len);
+    free(props);
+
     return EXIT_SUCCESS;
 }
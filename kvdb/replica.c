@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <kvdb.h>
+
+#include "internal.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define KVDB_REPLICA_BUCKETS 64
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+typedef struct kvdb_entry {
+    struct kvdb_entry* next;
+    size_t val_len;
+    char* value; /* right after the key */
+    char key[];
+} kvdb_entry;
+
+typedef struct kvdb_replica {
+    int fd; /* the local clients */
+    struct property_async* async; /* the monitor on kvdbd */
+    bool synced;
+    size_t count;
+    kvdb_entry* bucket[KVDB_REPLICA_BUCKETS];
+} kvdb_replica;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static kvdb_entry** kvdb_replica_find(kvdb_replica* replica, const char* key)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const char* p = key; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+
+    kvdb_entry** slot = &replica->bucket[hash % KVDB_REPLICA_BUCKETS];
+    while (*slot && strcmp((*slot)->key, key) != 0)
+        slot = &(*slot)->next;
+
+    return slot;
+}
+
+/* Store the value of the key, val_len 0 drops it */
+static void kvdb_replica_put(kvdb_replica* replica, const char* key,
+    const void* value, size_t val_len)
+{
+    kvdb_entry** slot = kvdb_replica_find(replica, key);
+    kvdb_entry* entry = *slot;
+
+    if (entry && entry->val_len == val_len) {
+        memcpy(entry->value, value, val_len);
+        return;
+    }
+
+    if (entry) {
+        *slot = entry->next;
+        replica->count--;
+        free(entry);
+    }
+
+    if (val_len == 0)
+        return;
+
+    size_t key_len = strlen(key) + 1;
+    entry = malloc(sizeof(kvdb_entry) + key_len + val_len);
+    if (entry == NULL) {
+        KVERR("no memory for %s\n", key);
+        return;
+    }
+
+    memcpy(entry->key, key, key_len);
+    entry->value = entry->key + key_len;
+    entry->val_len = val_len;
+    memcpy(entry->value, value, val_len);
+
+    entry->next = *slot;
+    *slot = entry;
+    replica->count++;
+}
+
+static void kvdb_replica_clear(kvdb_replica* replica)
+{
+    for (int i = 0; i < KVDB_REPLICA_BUCKETS; i++) {
+        while (replica->bucket[i]) {
+            kvdb_entry* entry = replica->bucket[i];
+            replica->bucket[i] = entry->next;
+            free(entry);
+        }
+    }
+
+    replica->count = 0;
+}
+
+static void kvdb_replica_notify(int err, const char* key, const void* value,
+    size_t val_len, void* cookie)
+{
+    if (err < 0)
+        KVERR("monitor refused %d\n", err);
+    else if (key)
+        kvdb_replica_put(cookie, key, value, val_len);
+}
+
+static void kvdb_replica_synced(int err, const char* key, const void* value,
+    size_t val_len, void* cookie)
+{
+    kvdb_replica* replica = cookie;
+
+    UNUSED(err);
+    UNUSED(key);
+    UNUSED(value);
+    UNUSED(val_len);
+    replica->synced = true;
+}
+
+static void kvdb_replica_seed(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    kvdb_replica_put(cookie, key, value, val_len);
+}
+
+/* Subscribe to all the keys, then copy them from a snapshot. Changes made
+ * meanwhile are queued as notifications and applied after it, in order,
+ * so the copy ends up as kvdbd has it.
+ */
+
+static int kvdb_replica_sync(kvdb_replica* replica)
+{
+    property_async_close(replica->async);
+    kvdb_replica_clear(replica);
+    replica->synced = false;
+
+    replica->async = property_async_open();
+    if (replica->async == NULL)
+        return -errno;
+
+    int fd = property_async_fd(replica->async);
+    int ret = property_async_monitor(replica->async, "*", kvdb_replica_notify, replica);
+    if (ret < 0)
+        return ret;
+
+    /* The reply of this get comes after the one of 'M', the subscription
+     * is in place once it arrives.
+     */
+
+    ret = property_async_get(replica->async, PROP_REPLICA_PATH, kvdb_replica_synced, replica);
+    while (ret >= 0 && !replica->synced) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+        ret = poll(&pfd, 1, -1);
+        if (ret >= 0)
+            ret = property_async_dispatch(replica->async);
+    }
+
+    if (ret < 0)
+        return ret;
+
+    ret = property_image_list(kvdb_replica_seed, replica);
+    if (ret < 0)
+        return ret;
+
+    KVINFO("replica of %zu keys\n", replica->count);
+    return 0;
+}
+
+static ssize_t kvdb_replica_recv(int fd, char* msg, ssize_t len, size_t end_pos)
+{
+    while (len < (ssize_t)end_pos) {
+        ssize_t ret = recv(fd, msg + len, end_pos - len, 0);
+        if (ret <= 0)
+            return ret < 0 ? -errno : -ENODATA;
+        len += ret;
+    }
+
+    return len;
+}
+
+/* Send a set or a delete to kvdbd, apply it here once it succeeded */
+static int32_t kvdb_replica_forward(kvdb_replica* replica, const char* msg, size_t len,
+    const char* key, const void* value, size_t val_len)
+{
+    int32_t err;
+
+    int fd = property_connect();
+    if (fd < 0)
+        return fd;
+
+    if (send(fd, msg, len, 0) < 0)
+        err = -errno;
+    else if (recv(fd, &err, sizeof(err), 0) != sizeof(err))
+        err = -EIO;
+
+    close(fd);
+
+    /* Notifications older than the write must not undo it */
+
+    if (err >= 0) {
+        property_async_dispatch(replica->async);
+        kvdb_replica_put(replica, key, value, val_len);
+    }
+
+    return err;
+}
+
+/* A one-shot request of a local client, with the layout of kvdbd */
+static void kvdb_replica_client(kvdb_replica* replica, int fd)
+{
+    char msg[PROP_MSG_MAX];
+
+    ssize_t len = recv(fd, msg, sizeof(msg), 0);
+    if (len < 2)
+        return;
+
+    /* All but 'D' have the length of the value in the third byte */
+
+    if (msg[0] != 'D') {
+        len = kvdb_replica_recv(fd, msg, len, 3);
+        if (len < 0)
+            return;
+    }
+
+    size_t key_len = (unsigned char)msg[1];
+    size_t val_len = msg[0] != 'D' ? (unsigned char)msg[2] : 0;
+    const char* key = msg + 3;
+    int32_t err;
+
+    switch (msg[0]) {
+    case 'G': {
+        if (kvdb_replica_recv(fd, msg, len, 3 + key_len) < 0 || key_len == 0
+            || key[key_len - 1] != '\0')
+            break;
+
+        kvdb_entry* entry = *kvdb_replica_find(replica, key);
+        if (entry)
+            send(fd, entry->value, MIN(entry->val_len, val_len), 0);
+        break;
+    }
+    case 'S':
+        if (key_len + val_len + 3 > sizeof(msg)
+            || kvdb_replica_recv(fd, msg, len, 3 + key_len + val_len) < 0
+            || key_len == 0 || key[key_len - 1] != '\0')
+            break;
+
+        err = kvdb_replica_forward(replica, msg, 3 + key_len + val_len,
+            key, key + key_len, val_len);
+        send(fd, &err, sizeof(err), 0);
+        break;
+    case 'D':
+        key = msg + 2;
+        if (kvdb_replica_recv(fd, msg, len, 2 + key_len) < 0 || key_len == 0
+            || key[key_len - 1] != '\0')
+            break;
+
+        err = kvdb_replica_forward(replica, msg, 2 + key_len, key, NULL, 0);
+        send(fd, &err, sizeof(err), 0);
+        break;
+    default:
+        KVERR("unexpected request %c\n", msg[0]);
+        break;
+    }
+}
+
+static int kvdb_replica_bind(void)
+{
+    const struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+        .sun_path = PROP_REPLICA_PATH,
+    };
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    if (bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0
+        || listen(fd, SOMAXCONN) < 0) {
+        int ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    kvdb_replica replica = { 0 };
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    /* A client gone before its reply must not kill the replica */
+    signal(SIGPIPE, SIG_IGN);
+
+    int ret = kvdb_replica_sync(&replica);
+    if (ret < 0) {
+        KVERR("sync failed %d\n", ret);
+        goto out;
+    }
+
+    /* Clients fall back to kvdbd until the copy is complete */
+
+    replica.fd = kvdb_replica_bind();
+    if (replica.fd < 0) {
+        ret = replica.fd;
+        KVERR("bind failed %d\n", ret);
+        goto out;
+    }
+
+    while (1) {
+        struct pollfd pfd[2] = {
+            { .fd = replica.fd, .events = POLLIN },
+            { .fd = property_async_fd(replica.async), .events = POLLIN },
+        };
+
+        ret = poll(pfd, 2, -1);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            ret = -errno;
+            break;
+        }
+
+        if (pfd[1].revents) {
+            ret = property_async_dispatch(replica.async);
+
+            /* kvdbd restarted, start over from a new snapshot */
+
+            while (ret < 0) {
+                KVWARN("lost kvdbd %d, syncing again\n", ret);
+                ret = kvdb_replica_sync(&replica);
+                if (ret < 0)
+                    sleep(1);
+            }
+        }
+
+        if (pfd[0].revents) {
+            int fd = accept(replica.fd, NULL, NULL);
+            if (fd >= 0) {
+                kvdb_replica_client(&replica, fd);
+                close(fd);
+            }
+        }
+    }
+
+    close(replica.fd);
+
+out:
+    property_async_close(replica.async);
+    kvdb_replica_clear(&replica);
+    return -ret;
+}
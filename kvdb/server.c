@@ -14,7 +14,11 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <fnmatch.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <sys/param.h>
 
@@ -39,71 +43,671 @@
 #define KVFD_COUNT 1
 #endif
 #define KVFD_MAX 8
+#define KVDB_KEY_BUCKETS 64
+#define KVDB_NOTIFY_MAX MAX(CONFIG_KVDB_NOTIFY_BUFFER, 2 * KVDB_FRAME_MAX)
+#define KVDB_TTL_SLOTS 64
+
+/* A client connection the server keeps open: a monitor channel opened by
+ * 'M' or a session opened by 'P', which carries framed requests in rx.
+ * Notifications wait in tx until kvdb_conn_flush() writes them at once,
+ * replies are written right away. What the socket does not take stays in
+ * tx until EPOLLOUT, a session is not served meanwhile. A session with a
+ * complete frame in rx waits in the ready queue of the transport it came
+ * from.
+ */
 
-typedef struct kvdb_monitor {
+typedef struct kvdb_conn {
     int fd;
+    int transport; /* KVFD_LOCAL or KVFD_REMOTE */
+    bool session;
+    bool dead;
+    bool ready;
+    bool stalled; /* tx waits for EPOLLOUT */
+    LIST_ENTRY(kvdb_conn)
+    entry;
+    TAILQ_ENTRY(kvdb_conn)
+    link;
+    char* tx;
+    size_t tx_len;
+    size_t tx_size; /* grows up to KVDB_NOTIFY_MAX */
+    int64_t rx_at; /* ms, the last read, remote deadlines count from it */
+    size_t len;
+    char rx[0];
+} kvdb_conn;
+
+typedef LIST_HEAD(kvdb_conn_head, kvdb_conn) kvdb_conn_head;
+typedef TAILQ_HEAD(kvdb_ready_head, kvdb_conn) kvdb_ready_head;
+
+/* Bulk work, served a slice at a time after the requests of each round:
+ * a list or a snapshot, whose image is taken at once and then streamed to
+ * its client, or a reload of the default values.
+ */
+
+typedef struct kvdb_bulk {
+    TAILQ_ENTRY(kvdb_bulk)
+    link;
+    int fd; /* the client of a list, -1 for a reload */
+    char* buf; /* the image of a list, the line and the path of a reload */
+    size_t len;
+    size_t pos;
+    const char* src; /* the paths left to reload */
+    FILE* f;
+    int retry;
+    bool stalled; /* the client does not read, wait for EPOLLOUT */
+} kvdb_bulk;
+
+typedef TAILQ_HEAD(kvdb_bulk_head, kvdb_bulk) kvdb_bulk_head;
+
+typedef struct kvdb_monitor {
     LIST_ENTRY(kvdb_monitor)
     entry;
+    kvdb_conn* conn;
+    uint32_t id;
+    bool stamp; /* KVDB_FLAG_STAMP */
     char key[0];
 } kvdb_monitor;
 
 typedef LIST_HEAD(kvdb_monitor_head, kvdb_monitor) kvdb_monitor_head;
 
+/* The keys changed since the server started, with their serial. A key
+ * set with a TTL also sits in a slot of the timer wheel until it expires.
+ * A request looks its key up once and hands the entry to the helpers.
+ * The entry of a deleted key is freed once nothing else hangs on it, the
+ * keys without an entry report the serial of the newest one freed.
+ */
+
+typedef struct kvdb_key {
+    LIST_ENTRY(kvdb_key)
+    entry;
+    uint32_t hash;
+    uint32_t serial;
+    struct kvdb_loc loc; /* where the backend keeps it */
+#ifdef CONFIG_KVDB_STATS
+    uint32_t hits;
+#endif
+#ifdef CONFIG_KVDB_TTL
+    LIST_ENTRY(kvdb_key)
+    timer;
+    int64_t expire; /* ms, 0 if the key doesn't expire */
+#endif
+#ifdef CONFIG_KVDB_QUOTA
+    uint16_t size; /* key and value bytes charged to the quotas, 0 if absent */
+#endif
+#ifdef CONFIG_KVDB_WRITEBACK
+    LIST_ENTRY(kvdb_key)
+    dirty;
+    bool buffered; /* a change is waiting in pending */
+    uint16_t pending_len;
+    char* pending; /* the latest value, NULL for a delete */
+#endif
+    char key[0];
+} kvdb_key;
+
+typedef LIST_HEAD(kvdb_key_head, kvdb_key) kvdb_key_head;
+
+#ifdef CONFIG_KVDB_QUOTA
+
+/* The limits of the keys starting with prefix, 0 for no limit. The keys
+ * are charged to every quota they match.
+ */
+
+typedef struct kvdb_quota {
+    const char* prefix;
+    size_t max_bytes;
+    size_t max_entries;
+    size_t bytes;
+    size_t entries;
+    ssize_t pending_bytes; /* a transaction being checked */
+    ssize_t pending_entries;
+} kvdb_quota;
+#endif
+
+#ifdef CONFIG_KVDB_STATS
+
+/* Backend latency histograms, bucket i counts calls below 2^i us */
+
+#define KVDB_STATS_GET 0
+#define KVDB_STATS_SET 1
+#define KVDB_STATS_COMMIT 2
+#define KVDB_STATS_COUNT 3
+#define KVDB_STATS_BUCKETS 16
+#define KVDB_STATS_HOT 8
+
+typedef struct kvdb_stats {
+    uint32_t ops[128];
+    uint32_t hist[KVDB_STATS_COUNT][KVDB_STATS_BUCKETS];
+    uint32_t lat_max[KVDB_STATS_COUNT];
+    uint32_t notify; /* notifications queued */
+    uint32_t notify_max; /* most subscribers of a single change */
+    uint32_t flush; /* writes of queued notifications */
+    uint32_t tx_max; /* most notification bytes queued on a connection */
+    uint32_t rx_max; /* most request bytes buffered on a session */
+    uint32_t batch_max; /* most events returned by one epoll_wait */
+    uint32_t deferred; /* scheduling rounds which left requests for the next */
+    uint32_t bulk; /* slices of bulk work served */
+    uint32_t late; /* requests dropped past their deadline */
+    uint32_t expired; /* keys dropped by their TTL */
+    uint32_t refused; /* sets over a quota */
+    uint32_t absorbed; /* buffered changes replaced before reaching the backend */
+    uint32_t flushed; /* buffered changes written to the backend */
+} kvdb_stats;
+#endif
+
+#ifdef CONFIG_KVDB_TRACE
+
+/* A sampled request, keys longer than the slot are cut */
+
+#define KVDB_TRACE_KEY 48
+#define KVDB_TRACE_PEER 16
+
+typedef struct kvdb_trace {
+    uint32_t time; /* ms */
+    uint32_t latency; /* us */
+    char op;
+    char peer[KVDB_TRACE_PEER];
+    char key[KVDB_TRACE_KEY];
+} kvdb_trace;
+
+/* The samples of one peer, op and key merged for the dump */
+
+typedef struct kvdb_trace_sum {
+    const kvdb_trace* t;
+    uint32_t count;
+    uint64_t latency;
+} kvdb_trace_sum;
+#endif
+
 typedef struct kvdb_server {
     struct kvdb* kvdb;
     int fd[KVFD_COUNT];
     int efd;
+    kvdb_conn_head conns;
+    kvdb_ready_head ready[KVFD_COUNT]; /* sessions with a request to serve */
+    bool pending[KVFD_COUNT]; /* listeners with a client to accept */
+    kvdb_bulk_head bulk; /* lists, snapshots and reloads, served in order */
     kvdb_monitor_head head;
+    kvdb_key_head keys[KVDB_KEY_BUCKETS];
+    uint32_t serial;
+    uint32_t reclaimed; /* the serial of the keys without an entry */
+    int64_t notify_at;
+#ifdef CONFIG_KVDB_TTL
+    kvdb_key_head wheel[KVDB_TTL_SLOTS]; /* slot of tick t is t % KVDB_TTL_SLOTS */
+    int64_t wheel_tick; /* the last tick expired */
+#endif
+#ifdef CONFIG_KVDB_QUOTA
+    kvdb_quota* quota;
+    size_t quota_count;
+    char* quota_buf;
+#endif
+#ifdef CONFIG_KVDB_WRITEBACK
+    kvdb_key_head dirty; /* the keys with a buffered change */
+    size_t dirty_bytes;
+#endif
+#ifdef CONFIG_KVDB_COMPACT
+    struct kvdb_compact_info compact;
+    int64_t compact_at; /* next compaction step, 0 if there is nothing to do */
+#endif
+#ifdef CONFIG_KVDB_STATS
+    kvdb_stats stats;
+#endif
+#ifdef CONFIG_KVDB_TRACE
+    kvdb_trace trace[CONFIG_KVDB_TRACE_SIZE];
+    uint32_t trace_head; /* requests seen, the ring index is the sampled ones */
+    uint32_t trace_count;
+#endif
 } kvdb_server;
 
-/* Open a monitor channel, add the [key, fd] pair to the monitor list and
- * add the pollfd to the pollfd array.
+/* FNV-1a */
+
+static uint32_t kvdb_hash(const char* key)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/* Look up the key in the key table, add it when create is true */
+static kvdb_key* kvdb_key_find(kvdb_server* server, const char* key, bool create)
+{
+    uint32_t hash = kvdb_hash(key);
+    kvdb_key_head* head = &server->keys[hash % KVDB_KEY_BUCKETS];
+    kvdb_key* k;
+
+    LIST_FOREACH(k, head, entry)
+    {
+        if (k->hash == hash && strcmp(k->key, key) == 0)
+            return k;
+    }
+
+    if (!create)
+        return NULL;
+
+    k = zalloc(sizeof(kvdb_key) + strlen(key) + 1);
+    if (k == NULL)
+        return NULL;
+
+    k->hash = hash;
+    kvdb_locate(key, &k->loc);
+    strcpy(k->key, key);
+    LIST_INSERT_HEAD(head, k, entry);
+    return k;
+}
+
+/* Look up the key of a request, NULL if it isn't a string of key_len */
+static kvdb_key* kvdb_key_intern(kvdb_server* server, const char* key, size_t key_len, bool create)
+{
+    if (key_len == 0 || key[key_len - 1] != '\0')
+        return NULL;
+
+    return kvdb_key_find(server, key, create);
+}
+
+static uint32_t kvdb_key_serial(kvdb_server* server, const char* key)
+{
+    kvdb_key* k = kvdb_key_find(server, key, false);
+    return k ? k->serial : server->reclaimed;
+}
+
+/* Free the entry of a key which is gone, or which was never changed, once
+ * no TTL, buffered change or quota charge needs it. A serial read before
+ * can't match again, the keys without an entry report a newer one now.
  */
-static int kvdb_monitor_open(kvdb_server* server, int fd, const char* key,
-    size_t key_len)
+static void kvdb_key_release(kvdb_server* server, kvdb_key* k)
 {
-    /* Malloc monitor element to store [key, fd] pair */
-    kvdb_monitor* mon = zalloc(sizeof(kvdb_monitor) + key_len);
-    if (mon == NULL) {
-        return -ENOMEM;
+    if (k == NULL)
+        return;
+
+#ifdef CONFIG_KVDB_TTL
+    if (k->expire)
+        return;
+#endif
+#ifdef CONFIG_KVDB_QUOTA
+    if (k->size)
+        return;
+#endif
+#ifdef CONFIG_KVDB_WRITEBACK
+    if (k->buffered)
+        return;
+#endif
+
+    if ((int32_t)(k->serial - server->reclaimed) > 0)
+        server->reclaimed = k->serial;
+
+    LIST_REMOVE(k, entry);
+    free(k);
+}
+
+/* Give the changed key a new serial, 0 is reserved for untouched keys */
+static uint32_t kvdb_key_touch(kvdb_server* server, kvdb_key* k)
+{
+    if (k == NULL)
+        return 0;
+
+    if (++server->serial == 0)
+        server->serial++;
+
+#ifdef CONFIG_KVDB_TTL
+    /* Any other change makes the key stay */
+    if (k->expire) {
+        LIST_REMOVE(k, timer);
+        k->expire = 0;
+    }
+#endif
+
+    k->serial = server->serial;
+    return k->serial;
+}
+
+static int64_t kvdb_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t kvdb_now_ms(void)
+{
+    return kvdb_now_us() / 1000;
+}
+
+/* The time sent with KVDB_FLAG_STAMP, it has to fit in a positive err */
+static int32_t kvdb_stamp(void)
+{
+    return kvdb_now_us() & INT32_MAX;
+}
+
+#if defined(CONFIG_KVDB_STATS) || defined(CONFIG_KVDB_TRACE)
+#define kvdb_clock() kvdb_now_us()
+#else
+#define kvdb_clock() 0
+#endif
+
+#ifdef CONFIG_KVDB_STATS
+#define kvdb_stats_set(server, field, value) \
+    ((server)->stats.field = MAX((server)->stats.field, (uint32_t)(value)))
+
+static void kvdb_stats_end(kvdb_server* server, int type, int64_t start)
+{
+    uint32_t us = kvdb_now_us() - start;
+    int i = 0;
+
+    while (i < KVDB_STATS_BUCKETS - 1 && us >= (1u << i))
+        i++;
+
+    server->stats.hist[type][i]++;
+    kvdb_stats_set(server, lat_max[type], us);
+}
+
+/* Count an access of the key, k is NULL if it isn't in the table yet */
+static void kvdb_stats_hit(kvdb_server* server, kvdb_key* k, const char* key)
+{
+    if (k == NULL)
+        k = kvdb_key_find(server, key, true);
+    if (k)
+        k->hits++;
+}
+#else
+#define kvdb_stats_set(server, field, value)
+#define kvdb_stats_end(server, type, start) UNUSED(start)
+#define kvdb_stats_hit(server, k, key) UNUSED(k)
+#endif
+
+#ifdef CONFIG_KVDB_TRACE
+
+/* Who is on the other end: the cpu for rpmsg, the pid for local peers */
+static void kvdb_trace_peer(int fd, char* peer)
+{
+    union {
+        struct sockaddr sa;
+#ifdef CONFIG_NET_RPMSG
+        struct sockaddr_rpmsg rp;
+#endif
+        struct sockaddr_un un;
+    } addr;
+    socklen_t len = sizeof(addr);
+
+    strlcpy(peer, "local", KVDB_TRACE_PEER);
+    if (getpeername(fd, &addr.sa, &len) < 0)
+        return;
+
+#ifdef CONFIG_NET_RPMSG
+    if (addr.sa.sa_family == AF_RPMSG) {
+        strlcpy(peer, addr.rp.rp_cpu, KVDB_TRACE_PEER);
+        return;
+    }
+#endif
+
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+        snprintf(peer, KVDB_TRACE_PEER, "pid:%d", (int)cred.pid);
+#endif
+}
+
+/* Record one in CONFIG_KVDB_TRACE_RATE requests, the oldest are dropped */
+static void kvdb_trace_add(kvdb_server* server, int fd, char op,
+    const char* key, int64_t start)
+{
+    if (server->trace_head++ % CONFIG_KVDB_TRACE_RATE != 0)
+        return;
+
+    int64_t now = kvdb_now_us();
+    kvdb_trace* t = &server->trace[server->trace_count++ % CONFIG_KVDB_TRACE_SIZE];
+
+    t->time = now / 1000;
+    t->latency = now - start;
+    t->op = op;
+    snprintf(t->key, sizeof(t->key), "%.*s", KVDB_TRACE_KEY - 1, key ? key : "");
+    kvdb_trace_peer(fd, t->peer);
+}
+
+/* The key of a one-shot request in msg, NULL if it has none */
+static const char* kvdb_trace_key(const char* msg)
+{
+    switch (msg[0]) {
+    case 'D':
+    case 'M':
+        return msg + 2;
+    case 'G':
+    case 'S':
+        return msg + 3;
+    case 'E':
+        return msg + 7;
+    case 'X':
+        return msg + 5;
+    default:
+        return NULL;
     }
+}
+#else
+#define kvdb_trace_add(server, fd, op, key, start) UNUSED(start)
+#endif
+
+/* Keep the client fd open and add it to the epoll */
+static kvdb_conn* kvdb_conn_open(kvdb_server* server, int fd, bool session)
+{
+    kvdb_conn* conn = zalloc(sizeof(kvdb_conn) + (session ? KVDB_MSG_MAX : 0));
+    if (conn == NULL)
+        return NULL;
 
-    /* Add the monitor fd to the epoll */
     struct epoll_event ev = {
-        .data.ptr = &mon->fd,
+        .data.ptr = &conn->fd,
         .events = EPOLLIN
     };
-    int ret = epoll_ctl(server->efd, EPOLL_CTL_ADD, fd, &ev);
-    if (ret < 0) {
-        free(mon);
-        return ret;
+    if (epoll_ctl(server->efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        free(conn);
+        return NULL;
+    }
+
+    conn->fd = fd;
+    conn->session = session;
+    LIST_INSERT_HEAD(&server->conns, conn, entry);
+    return conn;
+}
+
+/* Close the connection and drop all the monitors on it */
+static void kvdb_conn_close(kvdb_server* server, kvdb_conn* conn)
+{
+    kvdb_monitor* mon;
+    kvdb_monitor* tmp;
+
+    LIST_FOREACH_SAFE(mon, &server->head, entry, tmp)
+    {
+        if (mon->conn == conn) {
+            LIST_REMOVE(mon, entry);
+            free(mon);
+        }
+    }
+
+    if (conn->ready)
+        TAILQ_REMOVE(&server->ready[conn->transport], conn, link);
+
+    epoll_ctl(server->efd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    LIST_REMOVE(conn, entry);
+    free(conn->tx);
+    free(conn);
+}
+
+/* Write what the socket takes of tx, the rest waits for EPOLLOUT */
+static void kvdb_conn_send(kvdb_server* server, kvdb_conn* conn)
+{
+    if (conn->tx_len == 0 || conn->dead)
+        return;
+
+#ifdef CONFIG_KVDB_STATS
+    server->stats.flush++;
+#endif
+
+    ssize_t ret = send(conn->fd, conn->tx, conn->tx_len, MSG_DONTWAIT);
+    if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        /* Client close or some error happends, stop monitor */
+        conn->dead = true;
+        return;
+    }
+
+    if (ret > 0) {
+        conn->tx_len -= ret;
+        memmove(conn->tx, conn->tx + ret, conn->tx_len);
+    }
+
+    bool stalled = conn->tx_len > 0;
+    if (stalled != conn->stalled) {
+        struct epoll_event ev = {
+            .data.ptr = &conn->fd,
+            .events = stalled ? EPOLLOUT : EPOLLIN
+        };
+        if (epoll_ctl(server->efd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+            conn->dead = true;
+            return;
+        }
+
+        conn->stalled = stalled;
+    }
+}
+
+static void kvdb_conn_flush(kvdb_server* server)
+{
+    kvdb_conn* conn;
+
+    LIST_FOREACH(conn, &server->conns, entry)
+    {
+        kvdb_conn_send(server, conn);
+    }
+
+    server->notify_at = 0;
+}
+
+/* Append a message to tx, which grows up to KVDB_NOTIFY_MAX and is written
+ * first once the message doesn't fit. A client which leaves tx full is too
+ * slow to keep, it is closed.
+ */
+static bool kvdb_conn_append(kvdb_server* server, kvdb_conn* conn,
+    const struct iovec* iov, int iovcnt)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if (conn->tx_len + len > conn->tx_size && conn->tx_size < KVDB_NOTIFY_MAX) {
+        size_t size = MIN(MAX(conn->tx_size * 2, conn->tx_len + len), KVDB_NOTIFY_MAX);
+        char* tx = realloc(conn->tx, size);
+        if (tx == NULL) {
+            conn->dead = true;
+            return false;
+        }
+
+        conn->tx = tx;
+        conn->tx_size = size;
+    }
+
+    if (conn->tx_len + len > conn->tx_size)
+        kvdb_conn_send(server, conn);
+
+    if (conn->dead || conn->tx_len + len > conn->tx_size) {
+        conn->dead = true;
+        return false;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(conn->tx + conn->tx_len, iov[i].iov_base, iov[i].iov_len);
+        conn->tx_len += iov[i].iov_len;
     }
 
-    /* Add the [key, fd] pair to the monitor list */
-    mon->fd = fd;
+    kvdb_stats_set(server, tx_max, conn->tx_len);
+    return true;
+}
+
+/* Queue a notification, it is written once the coalescing window is over */
+static void kvdb_conn_queue(kvdb_server* server, kvdb_conn* conn,
+    const struct iovec* iov, int iovcnt)
+{
+    if (kvdb_conn_append(server, conn, iov, iovcnt) && server->notify_at == 0)
+        server->notify_at = kvdb_now_ms() + CONFIG_KVDB_NOTIFY_INTERVAL;
+}
+
+/* Close the connections failed in the middle of a loop iteration, they
+ * can't be freed right away since a caller up the stack may still use them.
+ */
+static void kvdb_conn_reap(kvdb_server* server)
+{
+    kvdb_conn* conn;
+    kvdb_conn* tmp;
+
+    LIST_FOREACH_SAFE(conn, &server->conns, entry, tmp)
+    {
+        if (conn->dead)
+            kvdb_conn_close(server, conn);
+    }
+}
+
+/* Add the [key, id] pair to the monitor list */
+static int kvdb_monitor_add(kvdb_server* server, kvdb_conn* conn, uint32_t id,
+    const char* key, size_t key_len, bool stamp)
+{
+    kvdb_monitor* mon = zalloc(sizeof(kvdb_monitor) + key_len);
+    if (mon == NULL) {
+        return -ENOMEM;
+    }
+
+    mon->conn = conn;
+    mon->id = id;
+    mon->stamp = stamp;
     strcpy(mon->key, key);
     LIST_INSERT_HEAD(&server->head, mon, entry);
 
     return 0;
 }
 
-/* Close the monitor fd, remove the fd from the monitor list and empty
- * corresponding pollfd.
- */
-static void kvdb_monitor_close(kvdb_server* server, struct epoll_event* ev)
+/* Drop the subscription id of the session, return -ENOENT if unknown */
+static int kvdb_monitor_remove(kvdb_server* server, kvdb_conn* conn, uint32_t id)
+{
+    kvdb_monitor* mon;
+    kvdb_monitor* tmp;
+    int ret = -ENOENT;
+
+    LIST_FOREACH_SAFE(mon, &server->head, entry, tmp)
+    {
+        if (mon->conn == conn && mon->id == id) {
+            LIST_REMOVE(mon, entry);
+            free(mon);
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+/* Open a monitor channel, the fd is owned by the server on success */
+static int kvdb_monitor_open(kvdb_server* server, int fd, const char* key,
+    size_t key_len)
 {
-    kvdb_monitor* mon = (kvdb_monitor*)ev->data.ptr;
+    kvdb_conn* conn = kvdb_conn_open(server, fd, false);
+    if (conn == NULL) {
+        return -ENOMEM;
+    }
 
-    /* Close the monitor fd and delete it from epoll */
-    epoll_ctl(server->efd, EPOLL_CTL_DEL, mon->fd, NULL);
-    close(mon->fd);
+    int ret = kvdb_monitor_add(server, conn, 0, key, key_len, false);
+    if (ret < 0) {
+        epoll_ctl(server->efd, EPOLL_CTL_DEL, fd, NULL);
+        LIST_REMOVE(conn, entry);
+        free(conn);
+    }
 
-    /* Remove the element from the monitor list */
-    LIST_REMOVE(mon, entry);
-    free(mon);
+    return ret;
 }
 
-/* Notify the client the value changed (updated or deleted) */
+/* Notify the client the value changed (updated or deleted), the entries
+ * of a subscriber pile up and go out together on the next flush.
+ */
 static void kvdb_monitor_notify(kvdb_server* server, const char* key, const void* value, size_t val_len)
 {
     size_t key_len = strlen(key) + 1;
@@ -119,222 +723,1397 @@ static void kvdb_monitor_notify(kvdb_server* server, const char* key, const void
       |   1   |   1   | key_len |
       |-------------------------|
       |key_len|   0   |[key'\0']|
-      *-------------------------*/
+      *-------------------------*
+      * sessions get a kvdb_reply header with the subscription id instead
+      */
 
     char cmd[2] = { key_len, val_len };
+    struct kvdb_reply frame = {
+        .hdr.op = 'N',
+        .hdr.key_len = key_len,
+        .hdr.val_len = val_len,
+    };
+
     struct iovec iov[3] = {
         { .iov_base = cmd, .iov_len = 2 },
         { .iov_base = (char*)key, .iov_len = key_len },
         { .iov_base = (char*)value, .iov_len = val_len },
     };
 
-    struct msghdr msg = { 0 };
-    msg.msg_iov = iov;
-    msg.msg_iovlen = value ? 3 : 2;
-
+    uint32_t count = 0;
+    int32_t stamp = -1;
     kvdb_monitor* mon;
-    kvdb_monitor* tmp;
-    LIST_FOREACH_SAFE(mon, &server->head, entry, tmp)
+    LIST_FOREACH(mon, &server->head, entry)
     {
-        if (fnmatch(mon->key, key, FNM_NOESCAPE) != 0)
+        if (mon->conn->dead || fnmatch(mon->key, key, FNM_NOESCAPE) != 0)
             continue;
 
-        if (sendmsg(mon->fd, &msg, 0) < 0) {
-            /* Client close or some error happends, stop monitor */
-            LIST_REMOVE(mon, entry);
-            epoll_ctl(server->efd, EPOLL_CTL_DEL, mon->fd, NULL);
-            close(mon->fd);
-            free(mon);
+        if (mon->stamp && stamp < 0)
+            stamp = kvdb_stamp();
+
+        count++;
+        if (mon->conn->session) {
+            frame.hdr.id = mon->id;
+            frame.err = mon->stamp ? stamp : 0;
+            iov[0].iov_base = &frame;
+            iov[0].iov_len = sizeof(frame);
+        } else {
+            iov[0].iov_base = cmd;
+            iov[0].iov_len = 2;
         }
+
+        kvdb_conn_queue(server, mon->conn, iov, value ? 3 : 2);
     }
+
+#ifdef CONFIG_KVDB_STATS
+    server->stats.notify += count;
+#endif
+    kvdb_stats_set(server, notify_max, count);
 }
 
-static bool kvdb_is_comment(const char* line)
+#ifdef CONFIG_KVDB_QUOTA
+static bool kvdb_quota_match(const kvdb_quota* q, const char* key)
 {
-    size_t i = strspn(line, " \t\r\n");
-    return line[i] == '\0' || line[i] == '#';
+    return strncmp(key, q->prefix, strlen(q->prefix)) == 0;
 }
 
-/****************************************************************************
- * Network Functions
- ****************************************************************************/
-
-static int kvdb_load(struct kvdb* kvdb, const char* src, bool force)
+/* Find the key of the table the quotas charge, NULL if no quota matches */
+static kvdb_key* kvdb_quota_key(kvdb_server* server, const char* key)
 {
-    char* tmpb;
-    const char* path;
-    const char* sep;
-    int retry = 20;
-
-    char* buf = malloc(PROP_MSG_MAX);
-    if (buf == NULL) {
-        KVERR("malloc failed\n");
-        return -ENOMEM;
+    for (size_t i = 0; i < server->quota_count; i++) {
+        if (kvdb_quota_match(&server->quota[i], key))
+            return kvdb_key_find(server, key, true);
     }
 
-    tmpb = malloc(PATH_MAX);
-    if (tmpb == NULL) {
+    return NULL;
+}
+
+/* Charge the new size of the key (0 once deleted) to its quotas */
+static void kvdb_quota_update(kvdb_server* server, kvdb_key* k, size_t size)
+{
+    if (k == NULL)
+        return;
+
+    for (size_t i = 0; i < server->quota_count; i++) {
+        kvdb_quota* q = &server->quota[i];
+
+        if (kvdb_quota_match(q, k->key)) {
+            q->bytes += size - k->size;
+            q->entries += (size != 0) - (k->size != 0);
+        }
+    }
+
+    k->size = size;
+}
+
+/* Add the growth of the key to the pending usage of its quotas */
+static void kvdb_quota_charge(kvdb_server* server, kvdb_key* k, size_t size)
+{
+    if (k == NULL)
+        return;
+
+    for (size_t i = 0; i < server->quota_count; i++) {
+        kvdb_quota* q = &server->quota[i];
+
+        if (kvdb_quota_match(q, k->key)) {
+            q->pending_bytes += (ssize_t)size - k->size;
+            q->pending_entries += (size != 0) - (k->size != 0);
+        }
+    }
+}
+
+/* Check and clear the pending usage, -ENOSPC if a quota would be exceeded.
+ * Shrinking is always allowed, even beyond the limits.
+ */
+static int kvdb_quota_commit(kvdb_server* server)
+{
+    int ret = 0;
+
+    for (size_t i = 0; i < server->quota_count; i++) {
+        kvdb_quota* q = &server->quota[i];
+
+        if ((q->max_bytes && q->pending_bytes > 0
+                && q->bytes + q->pending_bytes > q->max_bytes)
+            || (q->max_entries && q->pending_entries > 0
+                && q->entries + q->pending_entries > q->max_entries))
+            ret = -ENOSPC;
+
+        q->pending_bytes = 0;
+        q->pending_entries = 0;
+    }
+
+#ifdef CONFIG_KVDB_STATS
+    if (ret < 0)
+        server->stats.refused++;
+#endif
+
+    return ret;
+}
+
+static int kvdb_quota_check(kvdb_server* server, kvdb_key* k, size_t size)
+{
+    kvdb_quota_charge(server, k, size);
+    return kvdb_quota_commit(server);
+}
+
+/* Check a whole transaction, a key set twice in it is charged twice */
+static int kvdb_quota_txn(kvdb_server* server, const char* buf, size_t len)
+{
+    size_t pos = 0;
+
+    while (len - pos >= 3) {
+        size_t key_len = (unsigned char)buf[pos + 1];
+        size_t val_len = (unsigned char)buf[pos + 2];
+
+        if (key_len == 0 || len - pos < 3 + key_len + val_len
+            || buf[pos + 3 + key_len - 1] != '\0')
+            break; /* kvdb_txn_apply() refuses it */
+
+        kvdb_quota_charge(server, kvdb_quota_key(server, buf + pos + 3),
+            val_len ? key_len + val_len : 0);
+        pos += 3 + key_len + val_len;
+    }
+
+    return kvdb_quota_commit(server);
+}
+
+static void kvdb_quota_consume(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    UNUSED(value);
+    kvdb_quota_update(cookie, kvdb_quota_key(cookie, key), strlen(key) + 1 + val_len);
+}
+
+/* Parse CONFIG_KVDB_QUOTA, "prefix:bytes:entries" separated by ';', and
+ * charge the keys already in the store.
+ */
+static int kvdb_quota_init(kvdb_server* server)
+{
+    char* saveptr;
+    size_t count = 1;
+
+    if (CONFIG_KVDB_QUOTA[0] == '\0')
+        return 0;
+
+    for (const char* p = CONFIG_KVDB_QUOTA; *p; p++)
+        count += *p == ';';
+
+    server->quota_buf = strdup(CONFIG_KVDB_QUOTA);
+    server->quota = zalloc(count * sizeof(kvdb_quota));
+    if (server->quota_buf == NULL || server->quota == NULL)
+        return -ENOMEM;
+
+    for (char* item = strtok_r(server->quota_buf, ";", &saveptr); item;
+         item = strtok_r(NULL, ";", &saveptr)) {
+        kvdb_quota* q = &server->quota[server->quota_count];
+        char* sep = strchr(item, ':');
+
+        if (sep == NULL) {
+            KVERR("bad quota %s\n", item);
+            continue;
+        }
+
+        *sep++ = '\0';
+        q->prefix = item;
+        q->max_bytes = strtoul(sep, &sep, 0);
+        if (*sep == ':')
+            q->max_entries = strtoul(sep + 1, NULL, 0);
+        server->quota_count++;
+    }
+
+    return kvdb_list(server->kvdb, kvdb_quota_consume, server);
+}
+
+static void kvdb_quota_uninit(kvdb_server* server)
+{
+    free(server->quota);
+    free(server->quota_buf);
+}
+#else
+#define kvdb_quota_update(server, k, size)
+#define kvdb_quota_check(server, k, size) 0
+#define kvdb_quota_txn(server, buf, len) 0
+#endif
+
+#ifdef CONFIG_KVDB_WRITEBACK
+
+/* Write the buffered changes to the backend */
+static void kvdb_wb_flush(kvdb_server* server)
+{
+    kvdb_key* k;
+
+    while ((k = LIST_FIRST(&server->dirty)) != NULL) {
+        size_t key_len = strlen(k->key) + 1;
+        int ret;
+
+        if (k->pending)
+            ret = kvdb_set_at(server->kvdb, &k->loc, k->key, key_len, k->pending, k->pending_len, false);
+        else
+            ret = kvdb_delete_at(server->kvdb, &k->loc, k->key, key_len);
+        if (ret < 0)
+            KVERR("write back %s failed %d\n", k->key, ret);
+
+        LIST_REMOVE(k, dirty);
+        k->buffered = false;
+#ifdef CONFIG_KVDB_STATS
+        server->stats.flushed++;
+#endif
+        if (k->pending == NULL)
+            kvdb_key_release(server, k);
+        else {
+            free(k->pending);
+            k->pending = NULL;
+        }
+    }
+
+    server->dirty_bytes = 0;
+}
+
+/* Keep the latest change of the key, value is NULL for a delete. Returns
+ * 1 if it can't be buffered and has to go to the backend right away.
+ */
+static int kvdb_wb_put(kvdb_server* server, kvdb_key* k, const void* value, size_t val_len)
+{
+    char* pending = NULL;
+    if (value) {
+        pending = malloc(val_len);
+        if (pending == NULL) {
+            /* The backend gets the set, an older buffered change would
+             * be read instead and then overwrite it at the next flush.
+             */
+
+            if (k->buffered) {
+                LIST_REMOVE(k, dirty);
+                server->dirty_bytes -= k->pending_len;
+                free(k->pending);
+                k->pending = NULL;
+                k->buffered = false;
+            }
+
+            return 1;
+        }
+
+        memcpy(pending, value, val_len);
+    }
+
+    if (k->buffered) {
+        server->dirty_bytes -= k->pending_len;
+        free(k->pending);
+#ifdef CONFIG_KVDB_STATS
+        server->stats.absorbed++;
+#endif
+    } else {
+        LIST_INSERT_HEAD(&server->dirty, k, dirty);
+        k->buffered = true;
+    }
+
+    k->pending = pending;
+    k->pending_len = value ? val_len : 0;
+    server->dirty_bytes += k->pending_len;
+
+    /* Only a set adds bytes, a delete never flushes the key it buffers */
+
+    if (server->dirty_bytes > CONFIG_KVDB_WRITEBACK_SIZE)
+        kvdb_wb_flush(server);
+
+    return 0;
+}
+
+/* Buffer the set of a persist key, 1 if it has to go to the backend */
+static int kvdb_wb_set(kvdb_server* server, kvdb_key* k, const void* value, size_t val_len)
+{
+    if (k == NULL || k->loc.index != KVDB_PERSIST || val_len == 0 || val_len >= PROP_VALUE_MAX)
+        return 1;
+
+#ifdef CONFIG_KVDB_COMPRESS
+    /* Let the backend refuse the dictionary right away */
+
+    if (kvdb_dict_protect(k->key) < 0)
+        return 1;
+#endif
+
+    return kvdb_wb_put(server, k, value, val_len);
+}
+
+/* k is NULL if the key isn't in the table, it is added once found */
+static int kvdb_wb_delete(kvdb_server* server, kvdb_key* k, const char* key, size_t key_len)
+{
+    if ((k ? k->loc.index : kvdb_get_index(key)) != KVDB_PERSIST || key[key_len - 1] != '\0')
+        return 1;
+
+#ifdef CONFIG_KVDB_COMPRESS
+    if (kvdb_dict_protect(key) < 0)
+        return 1;
+#endif
+
+    if (k && k->buffered) {
+        if (k->pending == NULL)
+            return -ENOENT;
+    } else {
+        char value[PROP_VALUE_MAX];
+        ssize_t ret = k ? kvdb_get_at(server->kvdb, &k->loc, key, key_len, value, sizeof(value))
+                        : kvdb_get(server->kvdb, key, key_len, value, sizeof(value));
+        if (ret < 0)
+            return ret;
+
+        if (k == NULL)
+            k = kvdb_key_find(server, key, true);
+        if (k == NULL)
+            return 1;
+    }
+
+    return kvdb_wb_put(server, k, NULL, 0);
+}
+
+/* Read the buffered value of the key, false if it has none */
+static bool kvdb_wb_get(kvdb_server* server, kvdb_key* k, void* value,
+    size_t val_len, ssize_t* ret)
+{
+    if (k == NULL || !k->buffered)
+        return false;
+
+    if (k->pending == NULL) {
+        *ret = -ENOENT;
+    } else if (value) {
+        *ret = MIN(val_len, k->pending_len);
+        memcpy(value, k->pending, *ret);
+    } else {
+        *ret = k->pending_len;
+    }
+
+    return true;
+}
+#else
+#define kvdb_wb_flush(server)
+#define kvdb_wb_set(server, k, value, val_len) 1
+#define kvdb_wb_delete(server, k, key, key_len) 1
+#define kvdb_wb_get(server, k, value, val_len, ret) (UNUSED(k), false)
+#endif
+
+static ssize_t kvdb_server_get(kvdb_server* server, const char* key, size_t key_len,
+    void* value, size_t val_len)
+{
+#if defined(CONFIG_KVDB_STATS) || defined(CONFIG_KVDB_WRITEBACK)
+    kvdb_key* k = kvdb_key_intern(server, key, key_len, false);
+#else
+    kvdb_key* k = NULL; /* nothing is kept per key for a get */
+#endif
+    int64_t start = kvdb_clock();
+    ssize_t ret;
+
+    if (!kvdb_wb_get(server, k, value, val_len, &ret)) {
+        ret = k ? kvdb_get_at(server->kvdb, &k->loc, key, key_len, value, val_len)
+                : kvdb_get(server->kvdb, key, key_len, value, val_len);
+    }
+
+    kvdb_stats_end(server, KVDB_STATS_GET, start);
+    if (ret >= 0)
+        kvdb_stats_hit(server, k, key);
+
+    return ret;
+}
+
+static int kvdb_server_commit(kvdb_server* server)
+{
+    kvdb_wb_flush(server);
+
+    int64_t start = kvdb_clock();
+    int ret = kvdb_commit(server->kvdb);
+
+    kvdb_stats_end(server, KVDB_STATS_COMMIT, start);
+    return ret;
+}
+
+/* Store a key and let everyone watching it know */
+static int kvdb_server_set(kvdb_server* server, const char* key, size_t key_len,
+    const void* value, size_t val_len)
+{
+    kvdb_key* k = kvdb_key_intern(server, key, key_len, true);
+    int ret = kvdb_quota_check(server, k, key_len + val_len);
+    if (ret < 0)
+        return ret;
+
+    int64_t start = kvdb_clock();
+    ret = kvdb_wb_set(server, k, value, val_len);
+    if (ret > 0) {
+        ret = k ? kvdb_set_at(server->kvdb, &k->loc, key, key_len, value, val_len, false)
+                : kvdb_set(server->kvdb, key, key_len, value, val_len, false);
+    }
+
+    kvdb_stats_end(server, KVDB_STATS_SET, start);
+    if (ret >= 0) {
+        kvdb_stats_hit(server, k, key);
+        kvdb_key_touch(server, k);
+        kvdb_quota_update(server, k, key_len + val_len);
+        kvdb_monitor_notify(server, key, value, val_len);
+    } else if (k && k->serial == 0) {
+        kvdb_key_release(server, k); /* added for nothing */
+    }
+
+    return ret;
+}
+
+static int kvdb_server_delete(kvdb_server* server, const char* key, size_t key_len)
+{
+    kvdb_key* k = kvdb_key_intern(server, key, key_len, false);
+    int ret = kvdb_wb_delete(server, k, key, key_len);
+    if (ret > 0) {
+        ret = k ? kvdb_delete_at(server->kvdb, &k->loc, key, key_len)
+                : kvdb_delete(server->kvdb, key, key_len);
+    }
+    if (ret >= 0) {
+        if (k == NULL)
+            k = kvdb_key_find(server, key, true);
+        kvdb_key_touch(server, k);
+        kvdb_quota_update(server, k, 0);
+        kvdb_monitor_notify(server, key, NULL, 0);
+        kvdb_key_release(server, k); /* key may point into it */
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_KVDB_TTL
+
+/* Store a volatile key which is deleted after ttl ms. The key goes to the
+ * slot of the first tick at or after its expiry, keys further away than one
+ * turn of the wheel just stay in the slot for the next turns.
+ */
+static int kvdb_ttl_set(kvdb_server* server, const char* key, size_t key_len,
+    const void* value, size_t val_len, uint32_t ttl)
+{
+    if (ttl == 0 || strncmp(key, PERSIST_LABEL, strlen(PERSIST_LABEL)) == 0)
+        return -EINVAL;
+
+    int ret = kvdb_server_set(server, key, key_len, value, val_len);
+    if (ret < 0)
+        return ret;
+
+    kvdb_key* k = kvdb_key_find(server, key, true);
+    if (k == NULL)
+        return -ENOMEM;
+
+    k->expire = kvdb_now_ms() + ttl;
+
+    int64_t tick = (k->expire + CONFIG_KVDB_TTL_TICK - 1) / CONFIG_KVDB_TTL_TICK;
+    LIST_INSERT_HEAD(&server->wheel[tick % KVDB_TTL_SLOTS], k, timer);
+    return ret;
+}
+
+/* Delete the keys expired since the last call and notify their monitors */
+static void kvdb_ttl_expire(kvdb_server* server)
+{
+    int64_t now = kvdb_now_ms();
+    int64_t tick = now / CONFIG_KVDB_TTL_TICK;
+    int64_t first = MAX(server->wheel_tick + 1, tick - KVDB_TTL_SLOTS + 1);
+
+    for (int64_t t = first; t <= tick; t++) {
+        kvdb_key* k;
+        kvdb_key* tmp;
+
+        LIST_FOREACH_SAFE(k, &server->wheel[t % KVDB_TTL_SLOTS], timer, tmp)
+        {
+            if (k->expire > now)
+                continue;
+
+            LIST_REMOVE(k, timer);
+            k->expire = 0;
+#ifdef CONFIG_KVDB_STATS
+            server->stats.expired++;
+#endif
+
+            /* The delete frees the entry, one which failed leaves it to
+             * free here, there is nothing left to expire.
+             */
+
+            if (kvdb_server_delete(server, k->key, strlen(k->key) + 1) < 0)
+                kvdb_key_release(server, k);
+        }
+    }
+
+    server->wheel_tick = tick;
+}
+
+/* Milliseconds until the next tick with keys in its slot, -1 if none */
+static int kvdb_ttl_timeout(kvdb_server* server)
+{
+    for (int i = 1; i <= KVDB_TTL_SLOTS; i++) {
+        int64_t tick = server->wheel_tick + i;
+
+        if (!LIST_EMPTY(&server->wheel[tick % KVDB_TTL_SLOTS]))
+            return MAX(tick * CONFIG_KVDB_TTL_TICK - kvdb_now_ms(), 0);
+    }
+
+    return -1;
+}
+#endif
+
+static bool kvdb_is_comment(const char* line)
+{
+    size_t i = strspn(line, " \t\r\n");
+    return line[i] == '\0' || line[i] == '#';
+}
+
+/* Open the next file of the ';' separated paths, NULL after the last */
+static FILE* kvdb_load_open(const char** src, char* path, int* retry)
+{
+    while (**src) {
+        const char* sep = strchr(*src, ';');
+        size_t len = sep ? (size_t)(sep - *src) : strlen(*src);
+
+        strlcpy(path, *src, MIN(PATH_MAX, len + 1));
+        *src += sep ? len + 1 : len;
+
+        /* Wait filesystem mount success */
+        while (access(path, 0) < 0 && (*retry)-- > 0)
+            usleep(1000);
+
+        FILE* f = fopen(path, "re");
+        if (f)
+            return f;
+
+        KVERR("kvdb open:%s failed, errno:%d\n", path, errno);
+    }
+
+    return NULL;
+}
+
+/* Apply a "key=value" line, force overwrites the current value */
+static void kvdb_load_line(kvdb_server* server, char* buf, bool force)
+{
+    struct kvdb* kvdb = server->kvdb;
+
+    if (kvdb_is_comment(buf))
+        return;
+
+    char* tmp;
+    char* key = strtok_r(buf, "=", &tmp);
+    char* value = strtok_r(NULL, "\n", &tmp);
+    if (!key || !value)
+        return;
+
+    size_t key_len = strlen(key) + 1;
+    if (!force && kvdb_get(kvdb, key, key_len, NULL, 0) >= 0)
+        return;
+
+    size_t val_len = strlen(value) + 1;
+    if (kvdb_set(kvdb, key, key_len, value, val_len, true) >= 0 && force) {
+        kvdb_key* k = kvdb_key_find(server, key, true);
+
+        kvdb_key_touch(server, k);
+        kvdb_quota_update(server, k, key_len + val_len);
+        kvdb_monitor_notify(server, key, value, val_len);
+    }
+}
+
+/****************************************************************************
+ * Network Functions
+ ****************************************************************************/
+
+static int kvdb_load(kvdb_server* server, const char* src, bool force)
+{
+    int retry = 20;
+    FILE* f;
+
+    /* the defaults go to the backend, which has to be up to date */
+    kvdb_wb_flush(server);
+
+    char* buf = malloc(PROP_MSG_MAX + PATH_MAX);
+    if (buf == NULL) {
         KVERR("malloc failed\n");
-        free(buf);
         return -ENOMEM;
     }
-    path = tmpb;
 
-    while (*src) {
-        sep = strchr(src, ';');
-        if (sep) {
-            strlcpy(tmpb, src, MIN(PATH_MAX, sep - src + 1));
-            src = sep + 1;
-        } else {
-            path = src;
-            src += strlen(src);
+    while ((f = kvdb_load_open(&src, buf + PROP_MSG_MAX, &retry)) != NULL) {
+        while (fgets(buf, PROP_MSG_MAX, f))
+            kvdb_load_line(server, buf, force);
+
+        fclose(f);
+    }
+
+    kvdb_commit(server->kvdb);
+    free(buf);
+
+    return 0;
+}
+
+static int kvdb_bind(int fd[])
+{
+    const int family[] = {
+#ifdef CONFIG_NET_LOCAL
+        [KVFD_LOCAL] = AF_UNIX,
+#endif
+#ifdef CONFIG_NET_RPMSG
+        [KVFD_REMOTE] = AF_RPMSG,
+#endif
+    };
+
+#ifdef CONFIG_NET_LOCAL
+    const struct sockaddr_un addr0 = {
+        .sun_family = AF_UNIX,
+        .sun_path = PROP_SERVER_PATH,
+    };
+#endif
+
+#ifdef CONFIG_NET_RPMSG
+    const struct sockaddr_rpmsg addr1 = {
+        .rp_family = AF_RPMSG,
+        .rp_cpu = "",
+        .rp_name = PROP_SERVER_PATH,
+    };
+#endif
+
+    const struct sockaddr* addr[] = {
+#ifdef CONFIG_NET_LOCAL
+        [KVFD_LOCAL] = (const struct sockaddr*)&addr0,
+#endif
+#ifdef CONFIG_NET_RPMSG
+        [KVFD_REMOTE] = (const struct sockaddr*)&addr1,
+#endif
+    };
+
+    const socklen_t addrlen[] = {
+#ifdef CONFIG_NET_LOCAL
+        [KVFD_LOCAL] = sizeof(struct sockaddr_un),
+#endif
+#ifdef CONFIG_NET_RPMSG
+        [KVFD_REMOTE] = sizeof(struct sockaddr_rpmsg),
+#endif
+    };
+
+    memset(fd, 0, sizeof(*fd) * KVFD_COUNT);
+
+    for (int i = 0; i < KVFD_COUNT; i++) {
+        /* Non-blocking, the scheduler accepts until there is no client */
+        fd[i] = socket(family[i], SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd[i] < 0)
+            continue;
+
+        int ret = bind(fd[i], addr[i], addrlen[i]);
+        if (ret < 0)
+            return ret;
+
+        ret = listen(fd[i], SOMAXCONN);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static void kvdb_unbind(int fd[])
+{
+    for (int i = 0; i < KVFD_COUNT; i++)
+        if (fd[i] > 0)
+            close(fd[i]);
+}
+
+#ifdef CONFIG_KVDB_STATS
+static void kvdb_stats_put(kvdb_consume consume, void* cookie,
+    const char* name, const char* fmt, ...)
+{
+    char value[PROP_VALUE_MAX];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+
+    consume(name, value, strlen(value) + 1, cookie);
+}
+
+/* The percentile p of a histogram, as the upper bound of its bucket */
+static uint32_t kvdb_stats_percentile(const uint32_t* hist, uint32_t total,
+    uint32_t max, int p)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; total && i < KVDB_STATS_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum * 100ull >= (uint64_t)total * p)
+            return MIN(1u << i, max);
+    }
+
+    return 0;
+}
+
+/* Pass the statistics to consume as name/value pairs, like kvdb_list() */
+static void kvdb_stats_dump(kvdb_server* server, kvdb_consume consume, void* cookie)
+{
+    static const char* const lat[KVDB_STATS_COUNT] = { "get", "set", "commit" };
+    kvdb_stats* stats = &server->stats;
+    kvdb_key* hot[KVDB_STATS_HOT] = { 0 };
+    char name[PROP_NAME_MAX];
+
+    for (int op = 0; op < 128; op++) {
+        if (stats->ops[op]) {
+            snprintf(name, sizeof(name), "op.%c", op);
+            kvdb_stats_put(consume, cookie, name, "%" PRIu32, stats->ops[op]);
+        }
+    }
+
+    for (int type = 0; type < KVDB_STATS_COUNT; type++) {
+        const uint32_t* hist = stats->hist[type];
+        char value[PROP_VALUE_MAX];
+        uint32_t total = 0;
+        int len = 0;
+
+        for (int i = 0; i < KVDB_STATS_BUCKETS; i++) {
+            total += hist[i];
+            len += snprintf(value + len, sizeof(value) - len, "%s%" PRIu32, i ? "," : "", hist[i]);
+        }
+
+        snprintf(name, sizeof(name), "lat.%s.count", lat[type]);
+        kvdb_stats_put(consume, cookie, name, "%" PRIu32, total);
+        snprintf(name, sizeof(name), "lat.%s.p50_us", lat[type]);
+        kvdb_stats_put(consume, cookie, name, "%" PRIu32,
+            kvdb_stats_percentile(hist, total, stats->lat_max[type], 50));
+        snprintf(name, sizeof(name), "lat.%s.p99_us", lat[type]);
+        kvdb_stats_put(consume, cookie, name, "%" PRIu32,
+            kvdb_stats_percentile(hist, total, stats->lat_max[type], 99));
+        snprintf(name, sizeof(name), "lat.%s.max_us", lat[type]);
+        kvdb_stats_put(consume, cookie, name, "%" PRIu32, stats->lat_max[type]);
+        snprintf(name, sizeof(name), "lat.%s.hist", lat[type]);
+        kvdb_stats_put(consume, cookie, name, "%s", value);
+    }
+
+    kvdb_stats_put(consume, cookie, "monitor.notify", "%" PRIu32, stats->notify);
+    kvdb_stats_put(consume, cookie, "monitor.fanout_max", "%" PRIu32, stats->notify_max);
+    kvdb_stats_put(consume, cookie, "monitor.flush", "%" PRIu32, stats->flush);
+
+    uint32_t conns = 0;
+    uint32_t monitors = 0;
+    kvdb_conn* conn;
+    kvdb_monitor* mon;
+
+    LIST_FOREACH(conn, &server->conns, entry)
+    {
+        conns++;
+    }
+
+    LIST_FOREACH(mon, &server->head, entry)
+    {
+        monitors++;
+    }
+
+    kvdb_stats_put(consume, cookie, "queue.conns", "%" PRIu32, conns);
+    kvdb_stats_put(consume, cookie, "queue.monitors", "%" PRIu32, monitors);
+    kvdb_stats_put(consume, cookie, "queue.batch_max", "%" PRIu32, stats->batch_max);
+    kvdb_stats_put(consume, cookie, "queue.deferred", "%" PRIu32, stats->deferred);
+    kvdb_stats_put(consume, cookie, "queue.bulk", "%" PRIu32, stats->bulk);
+    kvdb_stats_put(consume, cookie, "queue.late", "%" PRIu32, stats->late);
+    kvdb_stats_put(consume, cookie, "queue.rx_max", "%" PRIu32, stats->rx_max);
+    kvdb_stats_put(consume, cookie, "queue.tx_max", "%" PRIu32, stats->tx_max);
+    kvdb_stats_put(consume, cookie, "ttl.expired", "%" PRIu32, stats->expired);
+    kvdb_stats_put(consume, cookie, "quota.refused", "%" PRIu32, stats->refused);
+    kvdb_stats_put(consume, cookie, "writeback.absorbed", "%" PRIu32, stats->absorbed);
+    kvdb_stats_put(consume, cookie, "writeback.flushed", "%" PRIu32, stats->flushed);
+
+#ifdef CONFIG_KVDB_COMPACT
+    kvdb_stats_put(consume, cookie, "compact.runs", "%" PRIu32, server->compact.runs);
+    kvdb_stats_put(consume, cookie, "compact.aborted", "%" PRIu32, server->compact.aborted);
+    kvdb_stats_put(consume, cookie, "compact.copied", "%zu", server->compact.copied);
+    kvdb_stats_put(consume, cookie, "compact.reclaimed", "%" PRId64, server->compact.reclaimed);
+#endif
+
+#ifdef CONFIG_KVDB_QUOTA
+    for (size_t i = 0; i < server->quota_count; i++) {
+        kvdb_quota* q = &server->quota[i];
+
+        snprintf(name, sizeof(name), "quota.%s", q->prefix);
+        kvdb_stats_put(consume, cookie, name, "bytes=%zu/%zu entries=%zu/%zu",
+            q->bytes, q->max_bytes, q->entries, q->max_entries);
+    }
+#endif
+
+    /* Top keys by gets and sets, kept sorted by insertion */
+
+    for (int i = 0; i < KVDB_KEY_BUCKETS; i++) {
+        kvdb_key* k;
+
+        LIST_FOREACH(k, &server->keys[i], entry)
+        {
+            int j = KVDB_STATS_HOT - 1;
+
+            if (k->hits == 0 || (hot[j] && hot[j]->hits >= k->hits))
+                continue;
+
+            for (; j > 0 && (hot[j - 1] == NULL || hot[j - 1]->hits < k->hits); j--)
+                hot[j] = hot[j - 1];
+
+            hot[j] = k;
+        }
+    }
+
+    for (int i = 0; i < KVDB_STATS_HOT && hot[i]; i++) {
+        snprintf(name, sizeof(name), "hot.%d", i);
+        kvdb_stats_put(consume, cookie, name, "%s %" PRIu32, hot[i]->key, hot[i]->hits);
+    }
+}
+#endif
+
+#ifdef CONFIG_KVDB_TRACE
+static int kvdb_trace_compare(const void* a, const void* b)
+{
+    const kvdb_trace_sum* x = a;
+    const kvdb_trace_sum* y = b;
+
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static bool kvdb_trace_same(const kvdb_trace* a, const kvdb_trace* b)
+{
+    return a->op == b->op && !strcmp(a->key, b->key) && !strcmp(a->peer, b->peer);
+}
+
+/* Pass the sampled requests to consume, like kvdb_list(). Raw gives one
+ * entry per sample, oldest first. Otherwise the samples of the same peer,
+ * op and key are merged, busiest first, which is where polling loops show
+ * up.
+ */
+static void kvdb_trace_dump(kvdb_server* server, bool raw, kvdb_consume consume, void* cookie)
+{
+    uint32_t count = MIN(server->trace_count, CONFIG_KVDB_TRACE_SIZE);
+    uint32_t first = server->trace_count - count;
+    char name[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+
+    if (raw) {
+        for (uint32_t i = 0; i < count; i++) {
+            const kvdb_trace* t = &server->trace[(first + i) % CONFIG_KVDB_TRACE_SIZE];
+
+            snprintf(name, sizeof(name), "trace.%" PRIu32, i);
+            snprintf(value, sizeof(value), "%" PRIu32 " %s %c %" PRIu32 " %s",
+                t->time, t->peer, t->op, t->latency, t->key);
+            consume(name, value, strlen(value) + 1, cookie);
+        }
+
+        return;
+    }
+
+    kvdb_trace_sum* sum = malloc(count * sizeof(kvdb_trace_sum));
+    if (sum == NULL)
+        return;
+
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const kvdb_trace* t = &server->trace[i];
+        uint32_t j;
+
+        for (j = 0; j < n && !kvdb_trace_same(sum[j].t, t); j++)
+            ;
+
+        if (j == n) {
+            sum[n].t = t;
+            sum[n].count = 0;
+            sum[n].latency = 0;
+            n++;
+        }
+
+        sum[j].count++;
+        sum[j].latency += t->latency;
+    }
+
+    qsort(sum, n, sizeof(kvdb_trace_sum), kvdb_trace_compare);
+
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "trace.%" PRIu32, i);
+        snprintf(value, sizeof(value), "%" PRIu32 " %s %c %" PRIu64 " %s",
+            sum[i].count, sum[i].t->peer, sum[i].t->op,
+            sum[i].latency / sum[i].count, sum[i].t->key);
+        consume(name, value, strlen(value) + 1, cookie);
+    }
+
+    free(sum);
+}
+#endif
+
+static ssize_t kvdb_recv(int sockfd, char* buf, size_t offset, size_t len)
+{
+    while (offset < len) {
+        ssize_t ret = recv(sockfd, buf + offset, len - offset, 0);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            return -ENODATA;
+        offset += ret;
+    }
+
+    return len;
+}
+
+/* Evaluate an atomic operation, reply the error, the serial and the
+ * resulting value (or the conflicting one on failure).
+ */
+static bool kvdb_atomic(kvdb_server* server, int fd, int type, const char* key,
+    size_t key_len, const void* arg, size_t arg_len, const void* value, size_t val_len)
+{
+    /*-----------------------------*
+     |  4  |   4  |  1  |   len   |
+     |-----------------------------|
+     |error|serial| len |[value]  |
+     *-----------------------------*/
+
+    char reply[9 + PROP_VALUE_MAX];
+    char newval[PROP_VALUE_MAX];
+    char* cur = reply + 9;
+    bool dirty = false;
+    size_t new_len;
+
+    ssize_t cur_len = kvdb_server_get(server, key, key_len, cur, PROP_VALUE_MAX);
+    uint32_t serial = kvdb_key_serial(server, key);
+    int32_t err = kvdb_atomic_eval(type, cur, cur_len, serial, arg, arg_len,
+        value, val_len, newval, &new_len);
+    if (err > 0) {
+        err = kvdb_server_set(server, key, key_len, newval, new_len);
+        if (err >= 0) {
+            dirty = true;
+            serial = kvdb_key_serial(server, key);
+            memcpy(cur, newval, new_len);
+            cur_len = new_len;
+        }
+    }
+
+    if (cur_len < 0)
+        cur_len = 0;
+
+    memcpy(reply, &err, 4);
+    memcpy(reply + 4, &serial, 4);
+    reply[8] = cur_len;
+    send(fd, reply, 9 + cur_len, 0);
+    return dirty;
+}
+
+static void kvdb_txn_notify(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    kvdb_server* server = cookie;
+    kvdb_key* k = kvdb_key_find(server, key, true);
+
+    kvdb_key_touch(server, k);
+    kvdb_quota_update(server, k, value ? strlen(key) + 1 + val_len : 0);
+    kvdb_monitor_notify(server, key, value, val_len);
+    if (value == NULL)
+        kvdb_key_release(server, k);
+}
+
+/* Receive the size bytes of records and the trailing 'E' of a transaction
+ * or a restore and apply them, the first len bytes are already in data.
+ */
+static void kvdb_transaction(kvdb_server* server, int fd, const char* data,
+    size_t len, size_t size, size_t max)
+{
+    int32_t err = -E2BIG;
+    char* buf = NULL;
+
+    if (size > max)
+        goto out;
+
+    /* records and the trailing 'E' */
+
+    buf = malloc(size + 1);
+    if (buf == NULL) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    len = MIN(len, size + 1);
+    memcpy(buf, data, len);
+    if (kvdb_recv(fd, buf, len, size + 1) < 0 || buf[size] != 'E') {
+        err = -EINVAL;
+        goto out;
+    }
+
+    err = kvdb_quota_txn(server, buf, size);
+    kvdb_wb_flush(server); /* the undo needs the latest values */
+    if (err >= 0)
+        err = kvdb_txn_apply(server->kvdb, buf, size, kvdb_txn_notify, server);
+
+out:
+    free(buf);
+    send(fd, &err, 4, 0);
+}
+
+/* Reply to a request of a session, with the notifications queued before */
+static void kvdb_session_reply(kvdb_server* server, kvdb_conn* conn,
+    const struct kvdb_frame* req, int32_t err, const void* value, size_t val_len)
+{
+    struct kvdb_reply reply = {
+        .hdr.op = req->op,
+        .hdr.val_len = val_len,
+        .hdr.id = req->id,
+        .err = err,
+    };
+
+    struct iovec iov[2] = {
+        { .iov_base = &reply, .iov_len = sizeof(reply) },
+        { .iov_base = (void*)value, .iov_len = val_len },
+    };
+
+    if (kvdb_conn_append(server, conn, iov, val_len ? 2 : 1))
+        kvdb_conn_send(server, conn);
+}
+
+/* Serve one framed request of a session, data holds key and value */
+static bool kvdb_session_request(kvdb_server* server, kvdb_conn* conn,
+    const struct kvdb_frame* req, const char* data)
+{
+    const char* key = data;
+    const char* value = data + req->key_len;
+    char buf[PROP_VALUE_MAX];
+    size_t out_len = 0;
+    bool dirty = false;
+    int32_t err;
+
+    int64_t start = kvdb_clock();
+
+#ifdef CONFIG_KVDB_STATS
+    server->stats.ops[req->op & 0x7f]++;
+#endif
+
+    if (req->op != 'C' && req->op != 'U'
+        && (req->key_len == 0 || key[req->key_len - 1] != '\0')) {
+        kvdb_session_reply(server, conn, req, -EINVAL, NULL, 0);
+        return false;
+    }
+
+    /* A remote request waited at least since the last read, its caller
+     * gave up once that is longer than the time it had left.
+     */
+
+    if (req->flags & KVDB_FLAG_DEADLINE) {
+        int64_t now = kvdb_now_ms();
+        uint32_t deadline;
+
+        memcpy(&deadline, value + req->val_len, sizeof(deadline));
+        if (conn->transport == KVFD_LOCAL ? (int32_t)((uint32_t)now - deadline) > 0
+                                          : now - conn->rx_at > deadline) {
+#ifdef CONFIG_KVDB_STATS
+            server->stats.late++;
+#endif
+            kvdb_session_reply(server, conn, req, -ETIMEDOUT, NULL, 0);
+            return false;
         }
+    }
+
+    switch (req->op) {
+    case 'G':
+        err = kvdb_server_get(server, key, req->key_len, buf, sizeof(buf));
+        if (err > 0)
+            out_len = err;
+        break;
+    case 'S':
+        err = kvdb_server_set(server, key, req->key_len, value, req->val_len);
+        dirty = err >= 0;
+        break;
+    case 'D':
+        err = kvdb_server_delete(server, key, req->key_len);
+        dirty = err >= 0;
+        break;
+    case 'C':
+        err = kvdb_server_commit(server);
+        break;
+    case 'M':
+        err = kvdb_monitor_add(server, conn, req->id, key, req->key_len,
+            (req->flags & KVDB_FLAG_STAMP) != 0);
+        if (err >= 0 && (req->flags & KVDB_FLAG_STAMP) != 0)
+            err = kvdb_stamp();
+        break;
+    case 'U': {
+        /* value is the id of the 'M' request which subscribed */
+        uint32_t id;
+
+        if (req->val_len != sizeof(id)) {
+            err = -EINVAL;
+            break;
+        }
+
+        memcpy(&id, value, sizeof(id));
+        err = kvdb_monitor_remove(server, conn, id);
+        break;
+    }
+    default:
+        err = -ENOSYS;
+        break;
+    }
+
+    kvdb_session_reply(server, conn, req, err, buf, out_len);
+    kvdb_trace_add(server, conn->fd, req->op, req->key_len ? key : NULL, start);
+    return dirty;
+}
+
+/* Serve up to max complete requests buffered in the session */
+static bool kvdb_session_parse(kvdb_server* server, kvdb_conn* conn, int max)
+{
+    bool dirty = false;
+    size_t pos = 0;
+
+    while (!conn->dead && !conn->stalled && max-- > 0 && conn->len - pos >= sizeof(struct kvdb_frame)) {
+        struct kvdb_frame req;
+
+        memcpy(&req, conn->rx + pos, sizeof(req));
+        size_t total = KVDB_FRAME_LEN(&req);
+        if (conn->len - pos < total)
+            break;
+
+        if (kvdb_session_request(server, conn, &req, conn->rx + pos + sizeof(req)))
+            dirty = true;
+
+        pos += total;
+    }
+
+    conn->len -= pos;
+    memmove(conn->rx, conn->rx + pos, conn->len);
+    return dirty;
+}
+
+/* Put the session in the ready queue of its transport while it has a
+ * complete request buffered, at the tail so the sessions take turns.
+ */
+static void kvdb_session_schedule(kvdb_server* server, kvdb_conn* conn)
+{
+    bool ready = false;
+
+    if (!conn->dead && !conn->stalled && conn->len >= sizeof(struct kvdb_frame)) {
+        struct kvdb_frame req;
+
+        memcpy(&req, conn->rx, sizeof(req));
+        ready = conn->len >= KVDB_FRAME_LEN(&req);
+    }
+
+    if (conn->ready)
+        TAILQ_REMOVE(&server->ready[conn->transport], conn, link);
+    if (ready)
+        TAILQ_INSERT_TAIL(&server->ready[conn->transport], conn, link);
+
+    conn->ready = ready;
+}
+
+static void kvdb_session_read(kvdb_server* server, kvdb_conn* conn)
+{
+    /* A full buffer holds requests enough, read the rest once they are served */
+
+    if (conn->len == KVDB_MSG_MAX)
+        return;
+
+    ssize_t ret = recv(conn->fd, conn->rx + conn->len, KVDB_MSG_MAX - conn->len, MSG_DONTWAIT);
+    if (ret <= 0) {
+        if (ret == 0 || (errno != EAGAIN && errno != EINTR))
+            conn->dead = true;
+        return;
+    }
+
+    conn->len += ret;
+    conn->rx_at = kvdb_now_ms();
+    kvdb_stats_set(server, rx_max, conn->len);
+    if (!conn->ready)
+        kvdb_session_schedule(server, conn);
+}
+
+/* Append an entry to the image of a list, in the format of 'L' */
+static void kvdb_bulk_consume(const char* key, const void* value, size_t val_len, void* cookie)
+{
+    kvdb_bulk* job = cookie;
+    size_t key_len = strlen(key) + 1;
+    size_t len = 2 + key_len + val_len;
 
-        /* Wait filesystem mount success */
-        while (access(path, 0) < 0 && retry-- > 0)
-            usleep(1000);
+    if (job->buf == NULL)
+        return;
 
-        FILE* f = fopen(path, "re");
-        if (!f) {
-            KVERR("kvdb open:%s failed, errno:%d\n", path, errno);
-            continue;
+    if (job->len + len + 2 > job->pos) {
+        size_t size = MAX(job->pos * 2, job->len + len + 2);
+        char* buf = realloc(job->buf, size);
+        if (buf == NULL) {
+            free(job->buf);
+            job->buf = NULL;
+            return;
         }
 
-        while (fgets(buf, PROP_MSG_MAX, f)) {
-            if (kvdb_is_comment(buf))
-                continue;
+        job->buf = buf;
+        job->pos = size;
+    }
 
-            char* tmp;
-            char* key = strtok_r(buf, "=", &tmp);
-            char* value = strtok_r(NULL, "\n", &tmp);
-            if (!key || !value)
-                continue;
+    job->buf[job->len] = key_len;
+    job->buf[job->len + 1] = val_len;
+    memcpy(job->buf + job->len + 2, key, key_len);
+    memcpy(job->buf + job->len + 2 + key_len, value, val_len);
+    job->len += len;
+}
 
-            size_t key_len = strlen(key) + 1;
-            if (!force && kvdb_get(kvdb, key, key_len, NULL, 0) >= 0)
-                continue;
+/* A new image, filled by kvdb_bulk_consume() and sent by kvdb_bulk_queue() */
+static kvdb_bulk* kvdb_bulk_image(void)
+{
+    kvdb_bulk* job = zalloc(sizeof(kvdb_bulk));
+    if (job == NULL)
+        return NULL;
 
-            kvdb_set(kvdb, key, key_len, value, strlen(value) + 1, true);
-        }
+    job->pos = PROP_MSG_MAX; /* the size of buf until the image is done */
+    job->buf = malloc(job->pos);
+    return job;
+}
 
-        fclose(f);
+/* End the image and queue it to fd, the job is freed on failure */
+static int kvdb_bulk_queue(kvdb_server* server, kvdb_bulk* job, int fd)
+{
+    if (job->buf == NULL) {
+        free(job);
+        return -ENOMEM;
     }
 
-    kvdb_commit(kvdb);
-    free(tmpb);
-    free(buf);
-
+    job->buf[job->len++] = 0; /* terminator */
+    job->buf[job->len++] = 0;
+    job->pos = 0;
+    job->fd = fd;
+    TAILQ_INSERT_TAIL(&server->bulk, job, link);
     return 0;
 }
 
-static int kvdb_bind(int fd[])
+/* Queue a list of fd, the image is taken now so the client sees the
+ * database as it is, whatever is served while it is sent.
+ */
+static int kvdb_bulk_list(kvdb_server* server, int fd)
 {
-    const int family[] = {
-#ifdef CONFIG_NET_LOCAL
-        [KVFD_LOCAL] = AF_UNIX,
-#endif
-#ifdef CONFIG_NET_RPMSG
-        [KVFD_REMOTE] = AF_RPMSG,
-#endif
-    };
+    kvdb_bulk* job = kvdb_bulk_image();
+    if (job == NULL)
+        return -ENOMEM;
 
-#ifdef CONFIG_NET_LOCAL
-    const struct sockaddr_un addr0 = {
-        .sun_family = AF_UNIX,
-        .sun_path = PROP_SERVER_PATH,
-    };
-#endif
+    kvdb_wb_flush(server);
+    kvdb_list(server->kvdb, kvdb_bulk_consume, job);
+    return kvdb_bulk_queue(server, job, fd);
+}
 
-#ifdef CONFIG_NET_RPMSG
-    const struct sockaddr_rpmsg addr1 = {
-        .rp_family = AF_RPMSG,
-        .rp_cpu = "",
-        .rp_name = PROP_SERVER_PATH,
-    };
-#endif
+static int kvdb_bulk_reload(kvdb_server* server)
+{
+    kvdb_bulk* job = zalloc(sizeof(kvdb_bulk));
+    if (job == NULL)
+        return -ENOMEM;
 
-    const struct sockaddr* addr[] = {
-#ifdef CONFIG_NET_LOCAL
-        [KVFD_LOCAL] = (const struct sockaddr*)&addr0,
-#endif
-#ifdef CONFIG_NET_RPMSG
-        [KVFD_REMOTE] = (const struct sockaddr*)&addr1,
-#endif
-    };
+    job->buf = malloc(PROP_MSG_MAX + PATH_MAX);
+    if (job->buf == NULL) {
+        free(job);
+        return -ENOMEM;
+    }
 
-    const socklen_t addrlen[] = {
-#ifdef CONFIG_NET_LOCAL
-        [KVFD_LOCAL] = sizeof(struct sockaddr_un),
-#endif
-#ifdef CONFIG_NET_RPMSG
-        [KVFD_REMOTE] = sizeof(struct sockaddr_rpmsg),
-#endif
-    };
+    job->fd = -1;
+    job->src = CONFIG_KVDB_SOURCE_PATH;
+    job->retry = 20;
+    TAILQ_INSERT_TAIL(&server->bulk, job, link);
+    return 0;
+}
 
-    memset(fd, 0, sizeof(*fd) * KVFD_COUNT);
+/* Send the next entries of the image, true once it is all sent or the
+ * client is gone. A client which does not read stalls its list only.
+ */
+static bool kvdb_bulk_send(kvdb_server* server, kvdb_bulk* job)
+{
+    size_t end = job->pos;
 
-    for (int i = 0; i < KVFD_COUNT; i++) {
-        fd[i] = socket(family[i], SOCK_STREAM | SOCK_CLOEXEC, 0);
-        if (fd[i] < 0)
+    for (int n = 0; n < CONFIG_KVDB_BULK_SLICE && end < job->len; n++)
+        end += 2 + (unsigned char)job->buf[end] + (unsigned char)job->buf[end + 1];
+
+    while (job->pos < end) {
+        ssize_t ret = send(job->fd, job->buf + job->pos, end - job->pos, MSG_DONTWAIT);
+        if (ret < 0 && errno == EINTR)
             continue;
+        else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct epoll_event ev;
 
-        int ret = bind(fd[i], addr[i], addrlen[i]);
-        if (ret < 0)
-            return ret;
+            ev.data.ptr = job;
+            ev.events = EPOLLOUT;
+            if (epoll_ctl(server->efd, EPOLL_CTL_ADD, job->fd, &ev) < 0)
+                return true;
 
-        ret = listen(fd[i], SOMAXCONN);
-        if (ret < 0)
-            return ret;
+            job->stalled = true;
+            return false;
+        } else if (ret <= 0)
+            return true; /* the client is gone */
+
+        job->pos += ret;
     }
 
-    return 0;
+    return job->pos == job->len;
 }
 
-static void kvdb_unbind(int fd[])
+/* Apply the next lines of the reload, true once they are all applied */
+static bool kvdb_bulk_load(kvdb_server* server, kvdb_bulk* job)
 {
-    for (int i = 0; i < KVFD_COUNT; i++)
-        if (fd[i] > 0)
-            close(fd[i]);
+    /* the defaults go to the backend, which has to be up to date */
+    kvdb_wb_flush(server);
+
+    for (int n = 0; n < CONFIG_KVDB_BULK_SLICE; n++) {
+        if (job->f == NULL) {
+            job->f = kvdb_load_open(&job->src, job->buf + PROP_MSG_MAX, &job->retry);
+            if (job->f == NULL) {
+                kvdb_commit(server->kvdb);
+                return true;
+            }
+        }
+
+        if (fgets(job->buf, PROP_MSG_MAX, job->f))
+            kvdb_load_line(server, job->buf, true);
+        else {
+            fclose(job->f);
+            job->f = NULL;
+        }
+    }
+
+    return false;
 }
 
-#ifdef CONFIG_KVDB_DUMPLIST
-static void kvdb_list_consume(const char* key, const void* value, size_t val_len, void* cookie)
+/* The first bulk work which can go on, NULL if there is none */
+static kvdb_bulk* kvdb_bulk_next(kvdb_server* server)
 {
-    size_t key_len = strlen(key) + 1;
-    char cmd[2] = {
-        key_len, val_len
-    };
-
-    struct iovec iov[3] = {
-        { .iov_base = cmd, .iov_len = 2 },
-        { .iov_base = (char*)key, .iov_len = key_len },
-        { .iov_base = (char*)value, .iov_len = val_len },
-    };
+    kvdb_bulk* job;
 
-    struct msghdr msg = { 0 };
-    msg.msg_iov = iov;
-    msg.msg_iovlen = 3;
+    TAILQ_FOREACH(job, &server->bulk, link)
+    {
+        if (!job->stalled)
+            break;
+    }
 
-    int fd = (intptr_t)cookie;
-    sendmsg(fd, &msg, 0);
+    return job;
 }
-#endif
 
-static ssize_t kvdb_recv(int sockfd, char* buf, size_t offset, size_t len)
+/* Wake up the stalled list of an EPOLLOUT, false if ptr is no list */
+static bool kvdb_bulk_wake(kvdb_server* server, void* ptr)
 {
-    while (offset < len) {
-        ssize_t ret = recv(sockfd, buf + offset, len - offset, 0);
-        if (ret < 0)
-            return ret;
-        if (ret == 0)
-            return -ENODATA;
-        offset += ret;
+    kvdb_bulk* job;
+
+    TAILQ_FOREACH(job, &server->bulk, link)
+    {
+        if (job == ptr) {
+            epoll_ctl(server->efd, EPOLL_CTL_DEL, job->fd, NULL);
+            job->stalled = false;
+            return true;
+        }
     }
 
-    return len;
+    return false;
+}
+
+/* Serve a slice of the first bulk work which can go on */
+static void kvdb_bulk_step(kvdb_server* server)
+{
+    kvdb_bulk* job = kvdb_bulk_next(server);
+    if (job == NULL)
+        return;
+
+#ifdef CONFIG_KVDB_STATS
+    server->stats.bulk++;
+#endif
+
+    if (job->fd >= 0 ? !kvdb_bulk_send(server, job) : !kvdb_bulk_load(server, job))
+        return;
+
+    TAILQ_REMOVE(&server->bulk, job, link);
+    if (job->fd >= 0)
+        close(job->fd);
+    if (job->f)
+        fclose(job->f);
+    free(job->buf);
+    free(job);
 }
 
-static bool kvdb_client(kvdb_server* server, int fd)
+static bool kvdb_client(kvdb_server* server, int fd, int transport)
 {
     bool dirty = false;
     ssize_t len;
@@ -349,7 +2128,7 @@ static bool kvdb_client(kvdb_server* server, int fd)
     setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 #endif
 
-    msg = malloc(PROP_MSG_MAX);
+    msg = malloc(KVDB_MSG_MAX);
     if (msg == NULL) {
         KVERR("malloc failed\n");
         goto out;
@@ -357,10 +2136,16 @@ static bool kvdb_client(kvdb_server* server, int fd)
 
     msg[0] = msg[1] = msg[2] = 0; /* zero the first key bytes */
 
-    len = recv(fd, msg, PROP_MSG_MAX, 0);
+    len = recv(fd, msg, KVDB_MSG_MAX, 0);
     if (len <= 0)
         goto out;
 
+    int64_t start = kvdb_clock();
+
+#ifdef CONFIG_KVDB_STATS
+    server->stats.ops[msg[0] & 0x7f]++;
+#endif
+
     switch (msg[0]) {
     case 'D': {
         size_t key_len = (unsigned char)msg[1];
@@ -371,11 +2156,9 @@ static bool kvdb_client(kvdb_server* server, int fd)
         const char* key = msg + 2;
         len = kvdb_recv(fd, msg, len, end_pos);
         if (len > 0) {
-            int32_t err = kvdb_delete(server->kvdb, key, key_len);
-            if (err >= 0) {
+            int32_t err = kvdb_server_delete(server, key, key_len);
+            if (err >= 0)
                 dirty = true;
-                kvdb_monitor_notify(server, key, NULL, 0);
-            }
             send(fd, &err, 4, 0);
         }
         break;
@@ -391,7 +2174,7 @@ static bool kvdb_client(kvdb_server* server, int fd)
         char value[PROP_VALUE_MAX];
         len = kvdb_recv(fd, msg, len, end_pos);
         if (len > 0) {
-            len = kvdb_get(server->kvdb, key, key_len, value, val_len);
+            len = kvdb_server_get(server, key, key_len, value, val_len);
             if (len > 0)
                 send(fd, value, len, 0);
         }
@@ -408,31 +2191,135 @@ static bool kvdb_client(kvdb_server* server, int fd)
         const char* value = key + key_len;
         len = kvdb_recv(fd, msg, len, end_pos);
         if (len > 0) {
-            int32_t err = kvdb_set(server->kvdb, key, key_len, value, val_len, false);
-            if (err >= 0) {
+            int32_t err = kvdb_server_set(server, key, key_len, value, val_len);
+            if (err >= 0)
                 dirty = true;
-                kvdb_monitor_notify(server, key, value, val_len);
-            }
             send(fd, &err, 4, 0);
         }
         break;
     }
-#ifdef CONFIG_KVDB_DUMPLIST
-    case 'L': {
-        kvdb_list(server->kvdb, kvdb_list_consume, (void*)(uintptr_t)fd);
-        send(fd, "\0", 2, 0); /* terminator */
+#ifdef CONFIG_KVDB_TTL
+    case 'E': {
+        /*-------------------------------------------*
+         | 1 |   1   |   1   | 4 | key_len |val_len|
+         |-------------------------------------------|
+         |'E'|key_len|val_len|ttl|[key'\0']|[value]|
+         *-------------------------------------------*/
+
+        size_t key_len = (unsigned char)msg[1];
+        size_t val_len = (unsigned char)msg[2];
+        size_t end_pos = key_len + val_len + 7;
+        if (key_len == 0 || end_pos > KVDB_MSG_MAX)
+            break;
+
+        const char* key = msg + 7;
+        const char* value = key + key_len;
+        len = kvdb_recv(fd, msg, len, end_pos);
+        if (len > 0) {
+            int32_t err = -EINVAL;
+            uint32_t ttl;
+
+            memcpy(&ttl, msg + 3, 4);
+            if (key[key_len - 1] == '\0')
+                err = kvdb_ttl_set(server, key, key_len, value, val_len, ttl);
+            if (err >= 0)
+                dirty = true;
+            send(fd, &err, 4, 0);
+        }
         break;
     }
 #endif
+#ifdef CONFIG_KVDB_DUMPLIST
+    case 'L':
+#endif
+    case 'I': {
+        /* a snapshot is a list, sent in slices from an image */
+        if (kvdb_bulk_list(server, fd) < 0)
+            break;
+
+        /* Keep fd open until the image is sent */
+        kvdb_trace_add(server, fd, msg[0], NULL, start);
+        free(msg);
+        return false;
+    }
+    case 'X': {
+        int type = (unsigned char)msg[1];
+        size_t key_len = (unsigned char)msg[2];
+        size_t arg_len = (unsigned char)msg[3];
+        size_t val_len = (unsigned char)msg[4];
+        size_t end_pos = key_len + arg_len + val_len + 5;
+        if (key_len == 0 || end_pos > KVDB_MSG_MAX)
+            break;
+
+        const char* key = msg + 5;
+        const char* arg = key + key_len;
+        const char* value = arg + arg_len;
+        len = kvdb_recv(fd, msg, len, end_pos);
+        if (len > 0 && key[key_len - 1] == '\0')
+            dirty = kvdb_atomic(server, fd, type, key, key_len, arg, arg_len, value, val_len);
+        break;
+    }
+    case 'B': {
+        /*----------------------------*
+         | 1 |  2 |  size   | 1 |
+         |----------------------------|
+         |'B'|size|[records]|'E'|
+         *----------------------------*/
+
+        uint16_t size;
+
+        if (kvdb_recv(fd, msg, len, 3) > 0) {
+            len = MAX(len, 3);
+            memcpy(&size, msg + 1, 2);
+            kvdb_transaction(server, fd, msg + 3, len - 3, size, CONFIG_KVDB_TRANSACTION_SIZE);
+        }
+        break;
+    }
+    case 'W': {
+        /*----------------------------*
+         | 1 |  4 |  size   | 1 |
+         |----------------------------|
+         |'W'|size|[records]|'E'|
+         *----------------------------*/
+
+        uint32_t size;
+
+        if (kvdb_recv(fd, msg, len, 5) > 0) {
+            len = MAX(len, 5);
+            memcpy(&size, msg + 1, 4);
+            kvdb_transaction(server, fd, msg + 5, len - 5, size, KVDB_RESTORE_MAX);
+        }
+        break;
+    }
     case 'C': {
-        int ret = kvdb_commit(server->kvdb);
+        int ret = kvdb_server_commit(server);
         send(fd, &ret, sizeof(ret), 0);
         break;
     }
     case 'R': {
-        kvdb_load(server->kvdb, CONFIG_KVDB_SOURCE_PATH, true);
+        if (kvdb_bulk_reload(server) < 0)
+            kvdb_load(server, CONFIG_KVDB_SOURCE_PATH, true);
         break;
     }
+#ifdef CONFIG_KVDB_STATS
+    case 'T': {
+        /* sent in slices like a list, a client which does not read can't
+         * stall the others
+         */
+        kvdb_bulk* job = kvdb_bulk_image();
+        if (job == NULL)
+            break;
+
+        kvdb_stats_dump(server, kvdb_bulk_consume, job);
+        if (kvdb_bulk_queue(server, job, fd) < 0)
+            break;
+
+        /* Keep fd open until the image is sent */
+        kvdb_trace_add(server, fd, msg[0], NULL, start);
+        free(msg);
+        return false;
+    }
+#endif
     case 'M': {
         /* Property monitor open operation */
         size_t key_len = (unsigned char)msg[1];
@@ -442,25 +2329,132 @@ static bool kvdb_client(kvdb_server* server, int fd)
 
         const char* key = msg + 2;
         len = kvdb_recv(fd, msg, len, end_pos);
-        if (len < 0 || key[key_len - 1]) {
+        if (len <= 0 || key[key_len - 1]) {
             break;
         }
-        if (len > 0) {
-            int32_t err = kvdb_monitor_open(server, fd, key, key_len);
-            send(fd, &err, 4, 0);
-        }
+
+        int32_t err = kvdb_monitor_open(server, fd, key, key_len);
+        send(fd, &err, 4, 0);
+        if (err < 0)
+            break;
+
         /* Direct return, not close the monitor fd */
+        kvdb_trace_add(server, fd, 'M', key, start);
+        free(msg);
+        return false;
+    }
+    case 'P': {
+        /* Switch to a session, the rest of msg are framed requests */
+        kvdb_conn* conn = kvdb_conn_open(server, fd, true);
+        if (conn == NULL)
+            break;
+
+        conn->transport = transport;
+        conn->rx_at = kvdb_now_ms();
+        conn->len = len - 1;
+        memcpy(conn->rx, msg + 1, conn->len);
+        kvdb_session_schedule(server, conn);
+        free(msg);
+        return false;
+    }
+#ifdef CONFIG_KVDB_TRACE
+    case 'K': {
+        /* sent in slices like the stats */
+        kvdb_bulk* job = kvdb_bulk_image();
+        if (job == NULL)
+            break;
+
+        kvdb_trace_dump(server, len > 1 && msg[1] == 'r', kvdb_bulk_consume, job);
+        if (kvdb_bulk_queue(server, job, fd) < 0)
+            break;
+
+        /* Keep fd open until the image is sent */
+        kvdb_trace_add(server, fd, msg[0], NULL, start);
         free(msg);
         return false;
     }
+#endif
     }
 
+    kvdb_trace_add(server, fd, msg[0], kvdb_trace_key(msg), start);
+
 out:
     free(msg);
     close(fd); /* done, close client socket */
     return dirty;
 }
 
+static bool kvdb_is_listener(kvdb_server* server, void* ptr)
+{
+    return ptr >= (void*)server->fd && ptr < (void*)(server->fd + KVFD_COUNT);
+}
+
+static bool kvdb_sched_busy(kvdb_server* server)
+{
+    for (int i = 0; i < KVFD_COUNT; i++) {
+        if (server->pending[i] || !TAILQ_EMPTY(&server->ready[i]))
+            return true;
+    }
+
+    return false;
+}
+
+/* One scheduling round: each transport, local first, serves up to its
+ * weight of requests, a one-shot client or a session frame each. The
+ * rest waits for the next round, after the new events are picked up, so
+ * a local client waits for a few remote requests at most, never for all
+ * the ones a busy remote core has queued. A slice of the bulk work comes
+ * last, lists and reloads go on under load but never hold a get up for
+ * longer than a slice.
+ */
+
+static bool kvdb_sched_round(kvdb_server* server)
+{
+    const int weight[KVFD_COUNT] = {
+#ifdef CONFIG_NET_LOCAL
+        [KVFD_LOCAL] = CONFIG_KVDB_LOCAL_WEIGHT,
+#endif
+#ifdef CONFIG_NET_RPMSG
+        [KVFD_REMOTE] = CONFIG_KVDB_REMOTE_WEIGHT,
+#endif
+    };
+    bool dirty = false;
+
+    for (int i = 0; i < KVFD_COUNT; i++) {
+        for (int n = 0; n < weight[i]; n++) {
+            kvdb_conn* conn = TAILQ_FIRST(&server->ready[i]);
+
+            /* New clients and ready sessions take turns */
+
+            if (server->pending[i] && (conn == NULL || n % 2 == 0)) {
+                int newfd = accept(server->fd[i], NULL, NULL);
+                if (newfd < 0) {
+                    /* Drained, epoll reports the next clients */
+                    server->pending[i] = false;
+                    n--;
+                    continue;
+                }
+
+                if (kvdb_client(server, newfd, i))
+                    dirty = true;
+            } else if (conn != NULL) {
+                if (kvdb_session_parse(server, conn, 1))
+                    dirty = true;
+                kvdb_session_schedule(server, conn);
+            } else
+                break;
+        }
+    }
+
+#ifdef CONFIG_KVDB_STATS
+    if (kvdb_sched_busy(server))
+        server->stats.deferred++;
+#endif
+
+    kvdb_bulk_step(server);
+    return dirty;
+}
+
 static void kvdb_loop(kvdb_server* server)
 {
     struct epoll_event evs[KVFD_MAX];
@@ -470,7 +2464,9 @@ static void kvdb_loop(kvdb_server* server)
     if (server->efd < 0)
         return;
 
+    TAILQ_INIT(&server->bulk);
     for (int i = 0; i < KVFD_COUNT; i++) {
+        TAILQ_INIT(&server->ready[i]);
         if (server->fd[i] >= 0) {
             evs[0].data.ptr = &server->fd[i];
             evs[0].events = EPOLLIN;
@@ -483,6 +2479,10 @@ static void kvdb_loop(kvdb_server* server)
 
     time_t next = 0;
 
+#ifdef CONFIG_KVDB_TTL
+    server->wheel_tick = kvdb_now_ms() / CONFIG_KVDB_TTL_TICK;
+#endif
+
     while (1) {
         int timeout = -1;
 
@@ -491,42 +2491,104 @@ static void kvdb_loop(kvdb_server* server)
             clock_gettime(CLOCK_MONOTONIC, &ts);
             timeout = (int)(next - ts.tv_sec);
             if (timeout <= 0) {
-                kvdb_commit(server->kvdb);
+                kvdb_server_commit(server);
                 timeout = -1;
                 next = 0;
             } else
                 timeout *= 1000;
         }
 
+#ifdef CONFIG_KVDB_TTL
+        /* drop the expired keys, wake up again for the next ones */
+        kvdb_ttl_expire(server);
+
+        int expire = kvdb_ttl_timeout(server);
+        if (expire >= 0 && (timeout < 0 || expire < timeout))
+            timeout = expire;
+#endif
+
+#ifdef CONFIG_KVDB_COMPACT
+        /* copy a few entries of a compaction whenever the server is idle */
+        if (server->compact_at && server->compact_at <= kvdb_now_ms()) {
+            int ret = kvdb_compact(server->kvdb, CONFIG_KVDB_COMPACT_STEP, &server->compact);
+            if (ret < 0)
+                KVERR("compact failed %d\n", ret);
+            server->compact_at = ret > 0 ? kvdb_now_ms() : 0;
+        }
+
+        if (server->compact_at) {
+            int idle = (int)MAX(server->compact_at - kvdb_now_ms(), 0);
+            if (timeout < 0 || idle < timeout)
+                timeout = idle;
+        }
+#endif
+
+        /* send the notifications once the coalescing window is over */
+        if (server->notify_at) {
+            int wait = (int)(server->notify_at - kvdb_now_ms());
+            if (wait <= 0)
+                kvdb_conn_flush(server);
+            else if (timeout < 0 || wait < timeout)
+                timeout = wait;
+        }
+
+        /* requests left by the last round only pick up the new events */
+        if (kvdb_sched_busy(server) || kvdb_bulk_next(server) != NULL)
+            timeout = 0;
+
         int nfds = epoll_wait(server->efd, evs, KVFD_MAX, timeout);
+        kvdb_stats_set(server, batch_max, nfds);
         for (int i = 0; i < nfds; i++) {
-            int fd = *(int*)evs[i].data.ptr;
-#ifdef CONFIG_NET_RPMSG
-            if (fd != server->fd[0] && fd != server->fd[1]) {
-#else
-            if (fd != server->fd[0]) {
-#endif
-                if ((evs[i].events & EPOLLHUP) != 0) {
-                    kvdb_monitor_close(server, &evs[i]);
+            if (kvdb_bulk_wake(server, evs[i].data.ptr))
+                continue; /* the list goes on, or finds its client gone */
+            else if (!kvdb_is_listener(server, evs[i].data.ptr)) {
+                kvdb_conn* conn = evs[i].data.ptr;
+                if (conn->dead)
+                    continue;
+
+                if ((evs[i].events & (EPOLLHUP | EPOLLERR)) != 0) {
+                    conn->dead = true;
+                    continue;
                 }
-                continue;
-            }
 
-            if ((evs[i].events & EPOLLIN) == 0)
-                continue;
+                /* the client reads again, a session goes on with its requests */
+                if ((evs[i].events & EPOLLOUT) != 0) {
+                    kvdb_conn_send(server, conn);
+                    if (conn->session)
+                        kvdb_session_schedule(server, conn);
+                }
 
-            int newfd = accept(fd, NULL, NULL);
-            if (newfd < 0)
-                continue;
+                if (conn->session && (evs[i].events & EPOLLIN) != 0)
+                    kvdb_session_read(server, conn);
+            } else if ((evs[i].events & EPOLLIN) != 0)
+                server->pending[(int*)evs[i].data.ptr - server->fd] = true;
+        }
 
-            /* is database changed? */
-            if (kvdb_client(server, newfd) && next == 0) {
-                clock_gettime(CLOCK_MONOTONIC, &ts);
-                next = ts.tv_sec + CONFIG_KVDB_COMMIT_INTERVAL;
-                if (next == 0)
-                    next++; /* ensure no zero */
-            }
+        bool dirty = kvdb_sched_round(server);
+
+#ifdef CONFIG_KVDB_COMPACT
+        if (dirty)
+            server->compact_at = 1;
+#endif
+
+        /* is database changed? */
+        if (dirty && next == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            next = ts.tv_sec + CONFIG_KVDB_COMMIT_INTERVAL;
+            if (next == 0)
+                next++; /* ensure no zero */
         }
+
+#ifdef CONFIG_KVDB_COMPACT
+        /* requests push the compaction back until the server is idle */
+        if (nfds > 0 && server->compact_at)
+            server->compact_at = kvdb_now_ms() + CONFIG_KVDB_COMPACT_IDLE;
+#endif
+
+#if CONFIG_KVDB_NOTIFY_INTERVAL == 0
+        kvdb_conn_flush(server);
+#endif
+        kvdb_conn_reap(server);
     }
 }
 
@@ -548,8 +2610,13 @@ int main(int argc, char* argv[])
     UNUSED(argc);
     UNUSED(argv);
     kvdb_server server = {
+        .conns = LIST_HEAD_INITIALIZER(),
         .head = LIST_HEAD_INITIALIZER(),
     };
+
+    /* A client gone in the middle of a reply must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
     int ret = kvdb_bind(server.fd);
     if (ret < 0)
         goto out;
@@ -558,8 +2625,15 @@ int main(int argc, char* argv[])
     if (ret < 0)
         goto out;
 
-    kvdb_load(server.kvdb, CONFIG_KVDB_SOURCE_PATH, false);
+    kvdb_load(&server, CONFIG_KVDB_SOURCE_PATH, false);
+#ifdef CONFIG_KVDB_QUOTA
+    if (kvdb_quota_init(&server) < 0)
+        KVERR("quota init failed\n");
+#endif
     kvdb_loop(&server);
+#ifdef CONFIG_KVDB_QUOTA
+    kvdb_quota_uninit(&server);
+#endif
     kvdb_uninit(server.kvdb);
 
 out:
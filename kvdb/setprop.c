@@ -14,21 +14,184 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <kvdb.h>
 
+/* Requests in flight on the session, the replies of a full window must fit
+ * in the socket buffer or kvdbd blocks on them while we block on a send.
+ */
+
+#define SETPROP_WINDOW 8
+
+/* Sets and deletes of a batch, pipelined over one session with kvdbd or
+ * applied in place with CONFIG_KVDB_DIRECT, committed once at the end.
+ */
+
+struct setprop_batch {
+    struct property_async* async;
+    int pending;
+    int err;
+};
+
+#ifndef CONFIG_KVDB_DIRECT
+static void setprop_done(int err, const char* key, const void* value, size_t val_len, void* cookie)
+{
+    struct setprop_batch* batch = cookie;
+
+    (void)key;
+    (void)value;
+    (void)val_len;
+    batch->pending--;
+    if (err < 0)
+        batch->err = err;
+}
+
+/* Run the callbacks until at most max requests are in flight */
+static int setprop_wait(struct setprop_batch* batch, int max)
+{
+    while (batch->pending > max) {
+        struct pollfd pfd = { .fd = property_async_fd(batch->async), .events = POLLIN };
+
+        if (poll(&pfd, 1, -1) < 0)
+            return -errno;
+
+        int ret = property_async_dispatch(batch->async);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+#endif
+
+static int setprop_submit(struct setprop_batch* batch, const char* key, const char* value)
+{
+#ifdef CONFIG_KVDB_DIRECT
+    int ret = value ? property_set(key, value) : property_delete(key);
+    if (ret < 0)
+        batch->err = ret;
+    return 0;
+#else
+    int max = SETPROP_WINDOW - 1;
+    int ret;
+
+    do {
+        ret = setprop_wait(batch, max);
+        if (ret < 0)
+            return ret;
+
+        if (value)
+            ret = property_async_set(batch->async, key, value, strlen(value) + 1, setprop_done, batch);
+        else
+            ret = property_async_delete(batch->async, key, setprop_done, batch);
+
+        /* The socket is full, let kvdbd catch up */
+        max = batch->pending - 1;
+    } while (ret == -EAGAIN && max >= 0);
+
+    /* A refused request fails the batch, the connection is still good */
+    if (ret == -EINVAL || ret == -E2BIG)
+        batch->err = ret;
+    else if (ret < 0)
+        return ret;
+    else
+        batch->pending++;
+
+    return 0;
+#endif
+}
+
+/* Lines of "key=value" set the key, a line of "key" deletes it */
+static int setprop_file(struct setprop_batch* batch, FILE* fp)
+{
+    char line[PROP_NAME_MAX + PROP_VALUE_MAX + 2];
+    int ret = 0;
+
+    while (ret >= 0 && fgets(line, sizeof(line), fp)) {
+        char* value;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        value = strchr(line, '=');
+        if (value)
+            *value++ = '\0';
+
+        ret = setprop_submit(batch, line, value);
+    }
+
+    return ret;
+}
+
+/* Apply the lines of file, "-" for stdin, or the key value pairs of argv */
+static int setprop_batch(const char* file, char* argv[], int argc)
+{
+    struct setprop_batch batch = { 0 };
+    int ret = 0;
+
+#ifndef CONFIG_KVDB_DIRECT
+    batch.async = property_async_open();
+    if (batch.async == NULL)
+        return -errno;
+#endif
+
+    if (file) {
+        FILE* fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+        if (fp == NULL)
+            ret = -errno;
+        else {
+            ret = setprop_file(&batch, fp);
+            if (fp != stdin)
+                fclose(fp);
+        }
+    } else {
+        for (int i = 0; ret >= 0 && i + 1 < argc; i += 2)
+            ret = setprop_submit(&batch, argv[i], argv[i + 1]);
+    }
+
+#ifndef CONFIG_KVDB_DIRECT
+    if (ret >= 0)
+        ret = setprop_wait(&batch, 0);
+    property_async_close(batch.async);
+#endif
+
+    return ret < 0 ? ret : batch.err;
+}
+
 int main(int argc, char* argv[])
 {
     int ret = 0;
 
-    if (argc == 3)
+    if (argc == 5 && !strcmp(argv[1], "-t"))
+        ret = -property_set_ttl(argv[3], argv[4], strlen(argv[4]) + 1, strtoul(argv[2], NULL, 0));
+    else if (argc == 3 && !strcmp(argv[1], "--restore")) {
+        int fd = open(argv[2], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            ret = errno;
+        else {
+            ret = -property_restore(fd);
+            close(fd);
+        }
+    } else if (argc == 3 && !strcmp(argv[1], "-f"))
+        ret = -setprop_batch(argv[2], NULL, 0);
+    else if (argc >= 5 && argc % 2 == 1)
+        ret = -setprop_batch(NULL, argv + 1, argc - 1);
+    else if (argc == 3)
         ret = -property_set(argv[1], argv[2]);
     else if (argc == 2 && strncmp(argv[1], "-h", 3))
         ret = -property_delete(argv[1]);
     else
-        printf("Usage: %s <key> [value]\n", argv[0]);
+        printf("Usage: %s [-t ttl_ms] <key> [value] | <key> <value> <key> <value>...\n"
+               "       | -f file | --restore file\n",
+            argv[0]);
 
     if (ret > 0)
         printf("Error: %s\n", strerror(ret));
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2023 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/****************************************************************************
+ * Included Files
+ ****************************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <kvdb.h>
+
+#include "internal.h"
+
+/****************************************************************************
+ * Private Types
+ ****************************************************************************/
+
+/* The value a key had before the transaction touched it. The undo log
+ * packs the old value of every record applied followed by this trailer,
+ * so it takes the real length of the values and is walked back from the
+ * end.
+ */
+
+typedef struct kvdb_undo {
+    size_t offset; /* of the record in the transaction */
+    ssize_t len; /* of the old value, negative if the key was absent */
+} kvdb_undo;
+
+typedef struct kvdb_undo_log {
+    char* buf;
+    size_t len;
+    size_t size;
+} kvdb_undo_log;
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+/* Check the record at pos, return its total length or -EINVAL */
+static ssize_t kvdb_txn_check(const char* buf, size_t len, size_t pos)
+{
+    if (len - pos < 3)
+        return -EINVAL;
+
+    char op = buf[pos];
+    size_t key_len = (unsigned char)buf[pos + 1];
+    size_t val_len = (unsigned char)buf[pos + 2];
+    size_t total = 3 + key_len + val_len;
+
+    if (key_len < 2 || key_len > PROP_NAME_MAX || len - pos < total)
+        return -EINVAL;
+
+    if (buf[pos + 3 + key_len - 1] != '\0')
+        return -EINVAL;
+
+    if ((op == 'S' && val_len == 0) || (op == 'D' && val_len != 0)
+        || (op != 'S' && op != 'D'))
+        return -EINVAL;
+
+    return total;
+}
+
+/* Save the value the key of the record at offset has now */
+static int kvdb_txn_save(struct kvdb* kvdb, kvdb_undo_log* log,
+    const char* buf, size_t offset)
+{
+    kvdb_undo undo = { .offset = offset };
+    char value[PROP_VALUE_MAX];
+
+    undo.len = kvdb_get(kvdb, buf + offset + 3, (unsigned char)buf[offset + 1],
+        value, sizeof(value));
+
+    size_t val_len = MAX(undo.len, 0);
+    size_t len = val_len + sizeof(undo);
+
+    if (log->len + len > log->size) {
+        size_t size = MAX(log->size * 2, log->len + len);
+        char* tmp = realloc(log->buf, size);
+        if (tmp == NULL)
+            return -ENOMEM;
+
+        log->buf = tmp;
+        log->size = size;
+    }
+
+    memcpy(log->buf + log->len, value, val_len);
+    memcpy(log->buf + log->len + val_len, &undo, sizeof(undo));
+    log->len += len;
+    return 0;
+}
+
+/* Put back the old values of the records saved in the log, newest first */
+static void kvdb_txn_rollback(struct kvdb* kvdb, const char* buf,
+    const kvdb_undo_log* log)
+{
+    size_t end = log->len;
+
+    while (end > 0) {
+        kvdb_undo undo;
+
+        memcpy(&undo, log->buf + end - sizeof(undo), sizeof(undo));
+        end -= sizeof(undo) + MAX(undo.len, 0);
+
+        const char* key = buf + undo.offset + 3;
+        size_t key_len = (unsigned char)buf[undo.offset + 1];
+
+        if (undo.len < 0)
+            kvdb_delete(kvdb, key, key_len);
+        else
+            kvdb_set(kvdb, key, key_len, log->buf + end, undo.len, true);
+    }
+}
+
+/****************************************************************************
+ * Public Functions
+ ****************************************************************************/
+
+/****************************************************************************
+ * Name: kvdb_txn_apply
+ *
+ * Description:
+ *   Apply the records of a transaction as one unit and commit the result.
+ *   The previous values are saved first, so a failure in the middle puts
+ *   every touched key back and nothing of the transaction is left behind.
+ *   The undo log lives in memory only: should the server die midway, a
+ *   backend writing through like NVS keeps the records applied so far.
+ *
+ * Input Parameters:
+ *   kvdb    - Pointer to the database instance.
+ *   buf     - The transaction records.
+ *   len     - The length of buf.
+ *   consume - Called for every record once all of them are applied, value
+ *             is NULL for deletes. May be NULL.
+ *   cookie  - Private data for consume callback.
+ *
+ * Returned Value:
+ *   0 on success, -ERRNO errno code if error.
+ *
+ ****************************************************************************/
+
+int kvdb_txn_apply(struct kvdb* kvdb, const char* buf, size_t len, kvdb_consume consume, void* cookie)
+{
+    size_t count = 0;
+    size_t pos;
+    ssize_t ret;
+
+    for (pos = 0; pos < len; pos += ret) {
+        ret = kvdb_txn_check(buf, len, pos);
+        if (ret < 0)
+            return ret;
+
+        count++;
+    }
+
+    if (count == 0)
+        return 0;
+
+    kvdb_undo_log log = { 0 };
+    size_t i;
+
+    for (i = 0, pos = 0; i < count; i++, pos += ret) {
+        const char* key = buf + pos + 3;
+        size_t key_len = (unsigned char)buf[pos + 1];
+        size_t val_len = (unsigned char)buf[pos + 2];
+
+        ret = 3 + key_len + val_len;
+
+        int err = kvdb_txn_save(kvdb, &log, buf, pos);
+        if (err >= 0 && buf[pos] == 'S')
+            err = kvdb_set(kvdb, key, key_len, key + key_len, val_len, false);
+        else if (err >= 0)
+            err = kvdb_delete(kvdb, key, key_len);
+
+        if (err < 0) {
+            KVERR("transaction record %zu failed %d\n", i, err);
+            kvdb_txn_rollback(kvdb, buf, &log);
+            free(log.buf);
+            return err;
+        }
+    }
+
+    free(log.buf);
+
+    ret = kvdb_commit(kvdb);
+
+    for (pos = 0; consume && pos < len; pos += 3 + (unsigned char)buf[pos + 1] + (unsigned char)buf[pos + 2]) {
+        const char* key = buf + pos + 3;
+        size_t key_len = (unsigned char)buf[pos + 1];
+        size_t val_len = (unsigned char)buf[pos + 2];
+
+        consume(key, val_len ? key + key_len : NULL, val_len, cookie);
+    }
+
+    return ret;
+}
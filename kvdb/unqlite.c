@@ -14,8 +14,13 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 #include <kvdb.h>
 #include <unqlite.h>
@@ -31,7 +36,23 @@ typedef struct kvdb_consume_data {
 } kvdb_consume_data;
 
 struct kvdb {
-    unqlite* db[KVDB_COUNT];
+    unqlite* db[KVDB_SHARD_MAX]; /* the shards are opened on first use */
+    int count; /* the stores and the shards */
+    uint32_t dirty; /* a bit per database changed since its commit */
+#ifdef CONFIG_KVDB_COMPACT
+    uint32_t churn[KVDB_SHARD_MAX]; /* sets and deletes since the last compaction */
+    int compact; /* the database being copied, -1 if none */
+    bool changed; /* it changed under the copy */
+    unqlite* fresh;
+    unqlite_kv_cursor* cur;
+#endif
+};
+
+static const char* g_kvdb_path[KVDB_COUNT] = {
+    [KVDB_PERSIST] = CONFIG_KVDB_PERSIST_PATH,
+#ifdef CONFIG_KVDB_TEMPORARY_STORAGE
+    [KVDB_MEM] = CONFIG_KVDB_TEMPORARY_PATH,
+#endif
 };
 
 /****************************************************************************
@@ -50,7 +71,71 @@ static bool unqlite_kv_is_exist(unqlite* db, const char* key, size_t key_len)
     return unqlite_kv_fetch(db, key, key_len, NULL, &value_len) >= 0;
 }
 
-int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len, const void* value, size_t val_len, bool force)
+/* The path of a database, "" keeps it in memory */
+static const char* kvdb_path(int i, char* buf)
+{
+#ifdef CONFIG_KVDB_CONTEXTS
+    const struct kvdb_shard* shard = kvdb_shard_get(i);
+
+    if (shard) {
+        const char* base = g_kvdb_path[shard->index];
+        if (base[0] == '\0')
+            return base;
+
+        snprintf(buf, PATH_MAX, "%s.%s", base, shard->name);
+        return buf;
+    }
+#endif
+
+    return g_kvdb_path[i];
+}
+
+static int kvdb_open(struct kvdb* kvdb, int i)
+{
+    char buf[PATH_MAX];
+
+    if (kvdb->db[i])
+        return 0;
+
+    const char* path = kvdb_path(i, buf);
+    if (path[0])
+        return unqlite_open(&kvdb->db[i], path, UNQLITE_OPEN_CREATE | UNQLITE_OPEN_OMIT_JOURNALING);
+
+#ifdef CONFIG_KVDB_TEMPORARY_STORAGE
+    return unqlite_open(&kvdb->db[i], NULL, UNQLITE_OPEN_IN_MEMORY);
+#else
+    return -EINVAL;
+#endif
+}
+
+/* Note a change to a database, a sync shard is committed right away */
+static int kvdb_changed(struct kvdb* kvdb, int i, int ret)
+{
+    if (ret < 0)
+        return ret;
+
+    kvdb->dirty |= 1u << i;
+
+#ifdef CONFIG_KVDB_COMPACT
+    kvdb->churn[i]++;
+    if (kvdb->compact == i)
+        kvdb->changed = true;
+#endif
+
+#ifdef CONFIG_KVDB_CONTEXTS
+    const struct kvdb_shard* shard = kvdb_shard_get(i);
+
+    if (shard && shard->sync) {
+        kvdb->dirty &= ~(1u << i);
+        ret = unqlite_commit(kvdb->db[i]);
+    }
+#endif
+
+    return ret;
+}
+
+int kvdb_set_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, const void* value, size_t val_len, bool force)
 {
     if (--key_len >= PROP_NAME_MAX)
         return -E2BIG;
@@ -62,17 +147,48 @@ int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len, const void* val
         return -E2BIG;
 
     /* no, then try database  */
-    int i = kvdb_get_index(key);
+    int i = loc->index;
     if (i < 0)
         return i;
 
-    if (!force && kvdb_is_readonly(key) && unqlite_kv_is_exist(kvdb->db[i], key, key_len + 1))
+    int s = loc->shard;
+    int ret = kvdb_open(kvdb, s);
+    if (ret < 0)
+        return ret;
+
+    if (!force && kvdb_is_readonly(key) && unqlite_kv_is_exist(kvdb->db[s], key, key_len + 1))
         return -EPERM;
 
-    return unqlite_kv_store(kvdb->db[i], key, ++key_len, value, val_len);
+#ifdef CONFIG_KVDB_COMPRESS
+    char packed[KVDB_PACK_MAX];
+
+    if (i == KVDB_PERSIST) {
+        ssize_t len = kvdb_pack(key, value, val_len, packed);
+        if (len < 0)
+            return len;
+
+        value = packed;
+        val_len = len;
+    }
+#endif
+
+    ret = unqlite_kv_store(kvdb->db[s], key, ++key_len, value, val_len);
+    return kvdb_changed(kvdb, s, ret);
 }
 
-ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len)
+int kvdb_set(struct kvdb* kvdb, const char* key, size_t key_len, const void* value, size_t val_len, bool force)
+{
+    struct kvdb_loc loc;
+
+    if (!key)
+        return -EINVAL;
+
+    kvdb_locate(key, &loc);
+    return kvdb_set_at(kvdb, &loc, key, key_len, value, val_len, force);
+}
+
+ssize_t kvdb_get_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key,
+    size_t key_len, void* value, size_t val_len)
 {
     if (--key_len >= PROP_NAME_MAX)
         return -E2BIG;
@@ -81,22 +197,51 @@ ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value
         return -EINVAL;
 
     /* no, then try database  */
-    int i = kvdb_get_index(key);
+    int i = loc->index;
     if (i < 0)
         return i;
 
+    int s = loc->shard;
+    int ret = kvdb_open(kvdb, s);
+    if (ret < 0)
+        return ret;
+
     unqlite_int64 val_size = val_len;
-    int ret = unqlite_kv_fetch(kvdb->db[i], key, ++key_len, value, &val_size);
+    void* buf = value;
+
+#ifdef CONFIG_KVDB_COMPRESS
+    char packed[KVDB_PACK_MAX];
+
+    if (i == KVDB_PERSIST) {
+        val_size = sizeof(packed);
+        buf = packed;
+    }
+#endif
+
+    ret = unqlite_kv_fetch(kvdb->db[s], key, ++key_len, buf, &val_size);
     if (ret < 0)
         return ret;
 
     if (val_size <= 0)
         return -EINVAL;
 
+#ifdef CONFIG_KVDB_COMPRESS
+    if (buf == packed)
+        return kvdb_unpack(packed, val_size, value, val_len);
+#endif
+
     return val_size;
 }
 
-int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
+ssize_t kvdb_get(struct kvdb* kvdb, const char* key, size_t key_len, void* value, size_t val_len)
+{
+    struct kvdb_loc loc;
+
+    kvdb_locate(key, &loc);
+    return kvdb_get_at(kvdb, &loc, key, key_len, value, val_len);
+}
+
+int kvdb_delete_at(struct kvdb* kvdb, const struct kvdb_loc* loc, const char* key, size_t key_len)
 {
     if (--key_len >= PROP_NAME_MAX)
         return -E2BIG;
@@ -107,18 +252,40 @@ int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
     if (kvdb_is_readonly(key))
         return -EPERM;
 
+#ifdef CONFIG_KVDB_COMPRESS
+    if (kvdb_dict_protect(key) < 0)
+        return -EPERM;
+#endif
+
     /* no, then try database  */
-    int i = kvdb_get_index(key);
-    if (i < 0)
-        return i;
+    if (loc->index < 0)
+        return loc->index;
+
+    int s = loc->shard;
+    int ret = kvdb_open(kvdb, s);
+    if (ret < 0)
+        return ret;
+
+    ret = unqlite_kv_delete(kvdb->db[s], key, ++key_len);
+    return kvdb_changed(kvdb, s, ret);
+}
 
-    return unqlite_kv_delete(kvdb->db[i], key, ++key_len);
+int kvdb_delete(struct kvdb* kvdb, const char* key, size_t key_len)
+{
+    struct kvdb_loc loc;
+
+    kvdb_locate(key, &loc);
+    return kvdb_delete_at(kvdb, &loc, key, key_len);
 }
 
 static int kvdb_list_value(const void* value, unsigned int len, void* arg)
 {
     kvdb_consume_data* data = arg;
+#ifdef CONFIG_KVDB_COMPRESS
+    kvdb_unpack_consume(data->consume, data->key, value, len, data->cookie);
+#else
     data->consume(data->key, value, len, data->cookie);
+#endif
     return 0;
 }
 
@@ -132,7 +299,10 @@ static int kvdb_list_key(const void* value, unsigned int len, void* arg)
 
 int kvdb_list(struct kvdb* kvdb, kvdb_consume consume, void* cookie)
 {
-    for (int i = 0; i < KVDB_COUNT; i++) {
+    for (int i = 0; i < kvdb->count; i++) {
+        if (kvdb_open(kvdb, i) < 0)
+            continue;
+
         unqlite_kv_cursor* cur = NULL;
         unqlite_kv_cursor_init(kvdb->db[i], &cur);
 
@@ -161,7 +331,14 @@ int kvdb_commit(struct kvdb* kvdb)
 {
     int ret = 0;
 
-    for (int i = 0; i < KVDB_COUNT; i++) {
+    /* Only the databases which changed, a shard is left alone otherwise */
+
+    for (int i = 0; i < kvdb->count; i++) {
+        if ((kvdb->dirty & (1u << i)) == 0)
+            continue;
+
+        kvdb->dirty &= ~(1u << i);
+
         int r = unqlite_commit(kvdb->db[i]);
         if (r < 0) {
             KVERR("commit db:%d error %d!\n", i, r);
@@ -174,10 +351,185 @@ int kvdb_commit(struct kvdb* kvdb)
     return ret;
 }
 
+#ifdef CONFIG_KVDB_COMPACT
+static void kvdb_compact_path(int i, char* path)
+{
+    char buf[PATH_MAX];
+
+    snprintf(path, PATH_MAX, "%s.compact", kvdb_path(i, buf));
+}
+
+/* Drop the half done copy */
+static void kvdb_compact_abort(struct kvdb* kvdb)
+{
+    char path[PATH_MAX];
+
+    kvdb_compact_path(kvdb->compact, path);
+    unqlite_kv_cursor_release(kvdb->db[kvdb->compact], kvdb->cur);
+    unqlite_close(kvdb->fresh);
+    unlink(path);
+
+    kvdb->cur = NULL;
+    kvdb->fresh = NULL;
+    kvdb->compact = -1;
+    kvdb->changed = false;
+}
+
+static int kvdb_compact_begin(struct kvdb* kvdb, int i)
+{
+    char path[PATH_MAX];
+
+    kvdb_compact_path(i, path);
+    unlink(path); /* left by a power loss */
+
+    int ret = unqlite_open(&kvdb->fresh, path, UNQLITE_OPEN_CREATE | UNQLITE_OPEN_OMIT_JOURNALING);
+    if (ret < 0)
+        return ret;
+
+    ret = unqlite_kv_cursor_init(kvdb->db[i], &kvdb->cur);
+    if (ret < 0) {
+        unqlite_close(kvdb->fresh);
+        kvdb->fresh = NULL;
+        return ret;
+    }
+
+    unqlite_kv_cursor_first_entry(kvdb->cur);
+    kvdb->compact = i;
+    kvdb->changed = false;
+    return 0;
+}
+
+/* All entries are copied, put the new file in place of the old one */
+static int kvdb_compact_end(struct kvdb* kvdb, struct kvdb_compact_info* info)
+{
+    int i = kvdb->compact;
+    char path[PATH_MAX];
+    char buf[PATH_MAX];
+    struct stat old;
+    struct stat new;
+
+    const char* file = kvdb_path(i, buf);
+    kvdb_compact_path(i, path);
+    unqlite_kv_cursor_release(kvdb->db[i], kvdb->cur);
+    kvdb->cur = NULL;
+    kvdb->compact = -1;
+
+    int ret = unqlite_close(kvdb->fresh);
+    kvdb->fresh = NULL;
+    if (ret < 0) {
+        unlink(path);
+        return ret;
+    }
+
+    /* Nothing is lost if the power goes off in between, either the old or
+     * the new file is complete and rename() swaps them in one step.
+     */
+
+    unqlite_close(kvdb->db[i]);
+    kvdb->db[i] = NULL;
+
+    if (stat(file, &old) < 0 || stat(path, &new) < 0
+        || rename(path, file) < 0) {
+        ret = -errno;
+        unlink(path);
+    } else {
+        info->reclaimed += (int64_t)old.st_size - new.st_size;
+        info->runs++;
+        kvdb->churn[i] = 0;
+        KVINFO("compacted %s %lld -> %lld\n", file,
+            (long long)old.st_size, (long long)new.st_size);
+    }
+
+    int err = kvdb_open(kvdb, i);
+    return err < 0 ? err : ret;
+}
+
+/****************************************************************************
+ * Name: kvdb_compact
+ *
+ * Description:
+ *   Rewrite the live entries of a database file into a fresh file and swap
+ *   it in, once CONFIG_KVDB_COMPACT_CHURN sets and deletes made it grow.
+ *   Every call copies at most count entries, so the server can spread the
+ *   work over its idle time. A change to the database in between restarts
+ *   the copy.
+ *
+ * Input Parameters:
+ *   kvdb  - Pointer to the database instance.
+ *   count - The most entries to copy in this call.
+ *   info  - Progress and reclaimed space, updated.
+ *
+ * Returned Value:
+ *   1 if there is more to copy, 0 if done or nothing to do, -ERRNO errno
+ *   code if error.
+ *
+ ****************************************************************************/
+
+int kvdb_compact(struct kvdb* kvdb, size_t count, struct kvdb_compact_info* info)
+{
+    char key[PROP_NAME_MAX];
+    char value[KVDB_PACK_MAX];
+    int ret;
+
+    if (kvdb->compact >= 0 && kvdb->changed) {
+        kvdb_compact_abort(kvdb);
+        info->aborted++;
+    }
+
+    if (kvdb->compact < 0) {
+        char buf[PATH_MAX];
+        int i;
+
+        for (i = 0; i < kvdb->count; i++) {
+            if (kvdb->churn[i] >= CONFIG_KVDB_COMPACT_CHURN && kvdb_path(i, buf)[0])
+                break;
+        }
+
+        if (i == kvdb->count)
+            return 0;
+
+        ret = kvdb_compact_begin(kvdb, i);
+        if (ret < 0)
+            return ret;
+
+        info->copied = 0;
+    }
+
+    while (count-- > 0 && unqlite_kv_cursor_valid_entry(kvdb->cur)) {
+        int key_len = sizeof(key);
+        unqlite_int64 val_len = sizeof(value);
+
+        ret = unqlite_kv_cursor_key(kvdb->cur, key, &key_len);
+        if (ret >= 0)
+            ret = unqlite_kv_cursor_data(kvdb->cur, value, &val_len);
+        if (ret >= 0)
+            ret = unqlite_kv_store(kvdb->fresh, key, key_len, value, val_len);
+        if (ret < 0) {
+            kvdb_compact_abort(kvdb);
+            info->aborted++;
+            return ret;
+        }
+
+        info->copied++;
+        unqlite_kv_cursor_next_entry(kvdb->cur);
+    }
+
+    if (unqlite_kv_cursor_valid_entry(kvdb->cur))
+        return 1;
+
+    return kvdb_compact_end(kvdb, info);
+}
+#endif
+
 void kvdb_uninit(struct kvdb* kvdb)
 {
     if (kvdb != NULL) {
-        for (int i = 0; i < KVDB_COUNT; i++) {
+#ifdef CONFIG_KVDB_COMPACT
+        if (kvdb->compact >= 0)
+            kvdb_compact_abort(kvdb);
+#endif
+
+        for (int i = 0; i < KVDB_SHARD_MAX; i++) {
             if (kvdb->db[i]) {
                 unqlite_close(kvdb->db[i]);
                 kvdb->db[i] = NULL;
@@ -191,32 +543,32 @@ void kvdb_uninit(struct kvdb* kvdb)
 
 int kvdb_init(struct kvdb** kvdb)
 {
-    static const char* path[KVDB_COUNT] = {
-        [KVDB_PERSIST] = CONFIG_KVDB_PERSIST_PATH,
-#ifdef CONFIG_KVDB_TEMPORARY_STORAGE
-        [KVDB_MEM] = CONFIG_KVDB_TEMPORARY_PATH,
-#endif
-    };
-
     int ret = 0;
 
     *kvdb = calloc(1, sizeof(struct kvdb));
     if (*kvdb == NULL)
         return -ENOMEM;
 
-    /* open database */
-    for (int i = 0; i < KVDB_COUNT; i++) {
-        if (path[i][0])
-            ret = unqlite_open(&(*kvdb)->db[i], path[i], UNQLITE_OPEN_CREATE | UNQLITE_OPEN_OMIT_JOURNALING);
-#ifdef CONFIG_KVDB_TEMPORARY_STORAGE
-        else
-            ret = unqlite_open(&(*kvdb)->db[i], NULL, UNQLITE_OPEN_IN_MEMORY);
+    (*kvdb)->count = KVDB_COUNT;
+#ifdef CONFIG_KVDB_CONTEXTS
+    (*kvdb)->count += kvdb_shard_init();
+#endif
+
+#ifdef CONFIG_KVDB_COMPACT
+    (*kvdb)->compact = -1;
 #endif
 
+    /* open database */
+    for (int i = 0; i < KVDB_COUNT; i++) {
+        ret = kvdb_open(*kvdb, i);
         if (ret < 0)
             goto out;
     }
 
+#ifdef CONFIG_KVDB_COMPRESS
+    kvdb_dict_init(*kvdb);
+#endif
+
     return ret;
 
 out: